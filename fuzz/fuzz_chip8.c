@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../include/chip8.h"
+
+/* libFuzzer entry point, the fuzzer bytes are loaded as a ROM into a
+	headless machine. SDL is linked in but never initialized, the core
+	only touches the screen buffer and the draw flag.
+
+	Nothing is allocated per input except the pages it writes. The ROM
+	is copied into one image over the last one and the machine is reset
+	by copying a pristine one attached to that image.
+
+	clang: make fuzz 	-> build/fuzz_chip8 corpus/
+	gcc:   make fuzz-replay	-> build/fuzz_chip8-replay crash-<sha1> ...
+*/
+
+// upper bound of cycles per input, keeps infinite loops from stalling the fuzzer
+#define FUZZ_CYCLES 2048
+// where chip8.c loads ROMs and starts the PC
+#define ROM_START 0x200
+#define ROM_MAX (SYS_MEMORY - ROM_START)
+
+// one image reused for every input, the harness is its only user
+static chip8_image_t *image;
+static size_t rom_len;
+// reset state captured once on the empty image, every input starts from a copy of it
+static chip8_t pristine;
+static chip8_t machine;
+
+int LLVMFuzzerInitialize(int *argc, char ***argv) {
+	(void)argc;
+	(void)argv;
+	image = chip8_image_create(NULL, 0);
+	if (image == NULL) exit(1);
+	// pristine holds the only reference
+	chip8_attach(&pristine, image);
+	chip8_image_release(image);
+	return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	if (size > ROM_MAX) return 0;
+
+	// swap the ROM in place, clearing what's left of the last one
+	memcpy(image->memory + ROM_START, data, size);
+	if (rom_len > size) memset(image->memory + ROM_START + size, 0, rom_len - size);
+	rom_len = size;
+	image->xo = size > CLASSIC_MEMORY - ROM_START;
+
+	// a clean page table onto the image, zeroed registers and screen
+	memcpy(&machine, &pristine, sizeof(machine));
+	machine.mem_mask = image->xo ? SYS_MEMORY - 1 : CLASSIC_MEMORY - 1;
+	machine.PC = ROM_START;
+	fetch(&machine);
+
+	for (int i = 0; i < FUZZ_CYCLES && machine.running; i++) {
+		decode_and_exec(&machine);
+		fetch(&machine);
+		// nobody presents the frame, drop it like the main loop would
+		machine.draw = 0;
+	}
+	// free the pages this input wrote, the rest are the image's
+	for (int i = 0; i < PAGE_COUNT; i++) {
+		if (machine.dirty[i]) free(machine.pages[i]);
+	}
+	return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+// replay driver for builds without libFuzzer, runs each file given once
+int main(int argc, char **argv) {
+	static uint8_t buf[ROM_MAX + 1];
+
+	LLVMFuzzerInitialize(&argc, &argv);
+	for (int i = 1; i < argc; i++) {
+		FILE *fp = fopen(argv[i], "rb");
+		if (fp == NULL) {
+			fprintf(stderr, "Error, opening input: %s\n", argv[i]);
+			return 1;
+		}
+		size_t len = fread(buf, sizeof(uint8_t), sizeof(buf), fp);
+		fclose(fp);
+
+		printf("Running: %s (%zu bytes)\n", argv[i], len);
+		LLVMFuzzerTestOneInput(buf, len);
+	}
+	return 0;
+}
+#endif
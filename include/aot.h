@@ -0,0 +1,40 @@
+#ifndef _AOT_H_
+#define _AOT_H_
+
+#include "chip8.h"
+
+/* A ROM compiled ahead of time to C by ch8aot, what the generated file
+	exports. Every instruction reachable from 0x200 through jumps, calls,
+	returns and skips gets a label running it through chip8_exec() with
+	its opcode as a constant, straight-line code falls through from one
+	label to the next and the run ends at the first branch, write or
+	halt. Its last instruction is fetched as usual, then it goes straight
+	on to the label of a jump or call target or either side of a skip,
+	returns and BNNN go through a switch on the PC.
+
+	A run is only entered if its bytes from there to the end still match
+	the ROM, pages the machine never wrote to are taken as is. Code the
+	scan didn't find, BNNN landing somewhere new and code the ROM rewrote
+	go through decode_and_exec() one instruction at a time until the PC
+	is back on a label. Every memory write ends a run so the check runs
+	again.
+
+	The debugger, tracing and profiling only see interpreted instructions,
+	with any of them attached the whole frame is interpreted. The machine
+	has to be loaded with aot_load(), a clean page is trusted to hold the
+	compiled ROM.
+*/
+
+typedef struct aot_stats {
+	uint64_t compiled;		// instructions run in compiled code
+	uint64_t interpreted;	// and through decode_and_exec()
+} aot_stats_t;
+
+extern aot_stats_t aot_stats;
+
+// load the compiled ROM's image, as chip8_load_image()
+int aot_load(chip8_t *chip8);
+// chip8_run_frame() running the compiled code where it can, the result is the same
+void aot_run_frame(chip8_t *chip8, size_t cycles);
+
+#endif
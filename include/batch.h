@@ -0,0 +1,68 @@
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include "chip8.h"
+
+/* Lockstep batch interpreter, BATCH_LANES machines running the same ROM
+	with different inputs, for seed sweeps and searches.
+
+	The registers, I, PC, the timers, keys and the stack are kept as
+	structure of arrays, lane n of every vector is machine n. Each step
+	runs one instruction on the group of lanes at the lowest PC, all of
+	them at once with SSE/AVX2 ops through GCC vector extensions. Lanes
+	that skipped or branched elsewhere are masked out until the others
+	catch up, which is where if/else style branches join again.
+
+	Drawing, memory and the rare instructions run through the core's
+	decode_and_exec() one lane at a time, on a chip8_t per lane that
+	also holds the memory pages and the screen. Every lane runs exactly
+	the cycles of a frame, as chip8_run_frame() would, so a lane ends
+	the frame in the same state as a scalar machine given the same keys.
+
+	The vectors want 32 byte alignment, batch_t can't be on the stack of
+	a thread with a smaller alignment, use a static or aligned_alloc().
+*/
+
+#define BATCH_LANES 16
+
+typedef uint8_t batch_u8 __attribute__((vector_size(BATCH_LANES)));
+typedef uint16_t batch_u16 __attribute__((vector_size(BATCH_LANES * 2)));
+// comparison results, -1 in the lanes where it holds
+typedef int8_t batch_m8 __attribute__((vector_size(BATCH_LANES)));
+typedef int16_t batch_m16 __attribute__((vector_size(BATCH_LANES * 2)));
+
+typedef struct batch {
+	batch_u8 V[16];
+	batch_u16 PC;			// next instruction, unlike chip8_t not past it
+	batch_u16 I;
+	batch_u8 DT;
+	batch_u8 ST;
+	batch_u16 keys;			// set by the caller before each frame
+	batch_u16 stack[16];
+	batch_u8 SP;
+	batch_m8 running;
+
+	// the rest of each machine, memory, screen, planes, halted
+	chip8_t lanes[BATCH_LANES];
+	size_t count;
+	// pages some lane wrote to, instructions there may differ between lanes
+	uint8_t written[PAGE_COUNT];
+
+	// stats
+	uint64_t steps;			// groups run
+	uint64_t vector_instr;	// lane instructions run in vectors
+	uint64_t scalar_instr;	// and through the core
+} batch_t;
+
+// attach count lanes (at most BATCH_LANES) to the image and reset them,
+// the lanes past count never run
+int batch_init(batch_t *batch, chip8_image_t *image, size_t count);
+// run cycles instructions on every lane then tick the timers, cycles < 65536
+void batch_run_frame(batch_t *batch, size_t cycles);
+// copy the lane's registers back into its chip8_t and return it
+chip8_t *batch_lane(batch_t *batch, size_t lane);
+// take the lane's registers from its chip8_t after it was changed
+void batch_load(batch_t *batch, size_t lane);
+void batch_free(batch_t *batch);
+
+#endif
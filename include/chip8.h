@@ -3,27 +3,61 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include <stdatomic.h>
 
 #include "SDL2/SDL.h"
 
-#define SYS_MEMORY 4096
-#define DISPLAY_WIDTH  64
-#define DISPLAY_HEIGHT 32
+// CHIP-8 and SCHIP, addresses wrap at 0xFFF
+#define CLASSIC_MEMORY 4096
+// XO-CHIP, the whole 16 bit address space
+#define SYS_MEMORY 65536
+// memory is mapped in pages, unwritten pages are shared between instances
+#define PAGE_SIZE  256
+#define PAGE_COUNT (SYS_MEMORY / PAGE_SIZE)
+// hires, lores uses the top left quarter at half the size each way
+#define DISPLAY_WIDTH  128
+#define DISPLAY_HEIGHT 64
+// XO-CHIP bitplanes, a pixel's colour is the bitmask of planes it is lit on
+#define DISPLAY_PLANES 2
+// instructions per 60 Hz frame for chip8_run_frame(), about 700 Hz
+#define CYCLES_PER_FRAME 12
+
+// One row of one plane, pixel x is bit 63 - x % 64 of word x / 64 so sprites
+// are blitted a row at a time, lores only uses the first word
+typedef struct chip8_row {
+	uint64_t w[2];
+} chip8_row_t;
 
 typedef struct stack {
 	size_t size;
 	uint16_t array[16];
-} stack_t;
+} chip8_stack_t;
 
-typedef struct chip8 {
+// Immutable fonts + ROM image, shared by every instance running the same ROM
+typedef struct chip8_image {
 	uint8_t memory[SYS_MEMORY];
+	uint8_t xo;		// the ROM doesn't fit in 4 KB, it runs in XO-CHIP mode
+	atomic_size_t refs;
+} chip8_image_t;
+
+typedef struct chip8 {
+	// page table over the attached image, written pages get a private copy
+	uint8_t *pages[PAGE_COUNT];
+	uint8_t dirty[PAGE_COUNT];	// 1 if the page is a private copy
+	chip8_image_t *image;
+	// every address is masked into RAM, reads and writes past the end wrap around
+	uint16_t mem_mask;		// CLASSIC_MEMORY - 1, or SYS_MEMORY - 1 in XO-CHIP mode
 	// screen buffer used to hold the pixels of the display
-	uint8_t screen[DISPLAY_WIDTH][DISPLAY_HEIGHT];
+	chip8_row_t screen[DISPLAY_PLANES][DISPLAY_HEIGHT];
+	uint8_t planes;			// bitmask of the planes drawn to, FN01
+	// XO-CHIP audio, a 1 bit 128 sample loop played while ST > 0
+	uint8_t pattern[16];
+	uint8_t pitch;
 	SDL_Window *window;
 	SDL_Renderer *renderer;
 	SDL_Texture *texture;
 	
-	stack_t	stack;
+	chip8_stack_t stack;
 	uint8_t registers[16];
 
 	uint16_t opcode; // current opcode, uint16_t union
@@ -33,14 +67,51 @@ typedef struct chip8 {
 	uint8_t DT;
 	uint8_t ST;
 
-	uint8_t key;	// current pressed key, 0 means None
+	uint16_t keys;	// bit n is set while hex key n is held down
 	// display struct pointer used to handle drawing to an SDL window
 	uint8_t running			:1; // flag
 	uint8_t draw			:1;	// flag
 	uint8_t paused			:1; // flag
-	uint8_t jmp_flag		:1;
+	uint8_t halted			:1; // waiting on FX0A for a key press
+	uint8_t trapped			:1; // stop requested by the debugger
+	uint8_t hires			:1;	// 128x64 instead of 64x32
+	uint8_t xo				:1;	// XO-CHIP mode for any ROM, set before loading it
+	// set while a gdb client is attached, NULL otherwise
+	struct gdb_stub *debugger;
+	// set while input-to-photon latency is measured, NULL otherwise
+	struct latency *latency;
+	// set while an execution trace is written, NULL otherwise
+	struct trace *trace;
+	// set while profiling, NULL otherwise
+	struct profile *profile;
+	// decode_and_exec()'s body, picked by chip8_set_hooks()
+	void (*exec)(struct chip8 *chip8);
 } chip8_t; 
 
+// Copy of a machine for rollback, only the private pages are stored. The
+// pages are allocated for the machine's address space on the first save
+typedef struct chip8_state {
+	uint8_t (*pages)[PAGE_SIZE];
+	size_t page_count;
+	uint8_t dirty[PAGE_COUNT];
+	chip8_row_t screen[DISPLAY_PLANES][DISPLAY_HEIGHT];
+	uint8_t planes;
+	uint8_t pattern[16];
+	uint8_t pitch;
+	chip8_stack_t stack;
+	uint8_t registers[16];
+
+	uint16_t opcode;
+	uint16_t PC;
+	uint16_t I;
+	uint8_t DT;
+	uint8_t ST;
+	uint16_t keys;
+	uint8_t running;
+	uint8_t halted;
+	uint8_t hires;
+} chip8_state_t;
+
 enum registers {
 	V0 = 0,
 	V1,
@@ -61,9 +132,72 @@ enum registers {
 };
 
 // The chip8 struct will be created on the stack in main, to skip uneccessery freeing and allocation
+// it has to start out zeroed, the page table is only valid after chip8_reset()
 int init(chip8_t *chip8, char *rom_path);
+// zero the machine state and drop the private pages, the attached image 
+// (or just the fonts) is mapped back in, SDL handles are left untouched
+void chip8_reset(chip8_t *chip8);
+// create a shared image from a ROM, returns NULL if it doesn't fit, the caller holds one reference.
+// A ROM too big for 4 KB runs in XO-CHIP mode
+chip8_image_t *chip8_image_create(const uint8_t *rom, size_t len);
+// drop a reference, frees the image on the last one
+void chip8_image_release(chip8_image_t *image);
+// reset the machine onto a shared image, takes a reference
+void chip8_attach(chip8_t *chip8, chip8_image_t *image);
+// free the private pages and release the image, the fonts stay mapped
+void chip8_detach(chip8_t *chip8);
+// copy a ROM image to 0x200 and point the PC at it, returns 1 if it doesn't fit
+int chip8_load_image(chip8_t *chip8, const uint8_t *image, size_t len);
+// read a ROM file and load it with chip8_load_image()
+int chip8_load_rom(chip8_t *chip8, const char *rom_path);
+
+// write a byte, the page gets copied out of the shared image first
+void chip8_poke(chip8_t *chip8, uint16_t addr, uint8_t val);
+
+// read a byte through the page table
+static inline uint8_t chip8_peek(const chip8_t *chip8, uint16_t addr) {
+	addr &= chip8->mem_mask;
+	return chip8->pages[addr / PAGE_SIZE][addr % PAGE_SIZE];
+}
+// read a big endian word, one page lookup unless it straddles two pages
+static inline uint16_t chip8_peek16(const chip8_t *chip8, uint16_t addr) {
+	addr &= chip8->mem_mask;
+	const uint8_t *p = &chip8->pages[addr / PAGE_SIZE][addr % PAGE_SIZE];
+	if (addr % PAGE_SIZE != PAGE_SIZE - 1) return p[0] << 8 | p[1];
+	return p[0] << 8 | chip8_peek(chip8, addr + 1);
+}
+
+// size of the current resolution
+static inline int chip8_width(const chip8_t *chip8) {
+	return chip8->hires ? DISPLAY_WIDTH : DISPLAY_WIDTH / 2;
+}
+static inline int chip8_height(const chip8_t *chip8) {
+	return chip8->hires ? DISPLAY_HEIGHT : DISPLAY_HEIGHT / 2;
+}
+// colour of a pixel, bit n is set if it's lit on plane n
+static inline uint8_t chip8_pixel(const chip8_t *chip8, int x, int y) {
+	int w = x / 64, bit = 63 - x % 64;
+	return (chip8->screen[0][y].w[w] >> bit & 1) | (chip8->screen[1][y].w[w] >> bit & 1) << 1;
+}
+
 // increment PC and store instruction
 void fetch(chip8_t *chip8);
 // decode and execute instruction
 void decode_and_exec(chip8_t *chip8);
+// attach an execution trace and a profiler, NULL for none
+void chip8_set_hooks(chip8_t *chip8, struct trace *trace, struct profile *profile);
+// run one 60 Hz frame, cycles instructions then a timer tick
+void chip8_run_frame(chip8_t *chip8, size_t cycles);
+// count DT and ST down, called at 60 Hz, ends a frame in the trace
+void chip8_tick_timers(chip8_t *chip8);
+
+// snapshots for rollback, the machine has to stay attached to the same image,
+// returns 1 if out of memory
+int chip8_save_state(const chip8_t *chip8, chip8_state_t *state);
+// returns 1 if out of memory, the machine is left untouched
+int chip8_load_state(chip8_t *chip8, const chip8_state_t *state);
+// FNV-1a of a snapshot, equal on every peer that ran the same inputs
+uint32_t chip8_state_hash(const chip8_state_t *state);
+// free a snapshot's pages, it can be saved to again
+void chip8_state_free(chip8_state_t *state);
 #endif
\ No newline at end of file
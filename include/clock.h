@@ -0,0 +1,14 @@
+#ifndef _CLOCK_H_
+#define _CLOCK_H_
+
+#include <stdint.h>
+#include <time.h>
+
+// monotonic clock in ns, for pacing and the timing stats
+static inline uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+#endif
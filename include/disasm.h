@@ -0,0 +1,12 @@
+#ifndef _DISASM_H_
+#define _DISASM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Cowgod style mnemonic of an instruction, with the SCHIP and XO-CHIP
+// extensions, next is the word after it for F000 NNNN. Returns the
+// length in bytes, 4 for F000 and 2 for the rest.
+int disasm(uint16_t op, uint16_t next, char *out, size_t len);
+
+#endif
@@ -7,6 +7,8 @@ int displ_init_SDL();
 SDL_Window *displ_init_Window();
 SDL_Renderer *displ_init_Renderer(SDL_Window *window);
 SDL_Texture *displ_init_Texture(SDL_Renderer *renderer);
+// window, renderer and texture for the machine, everything is torn down again on error
+int displ_init(chip8_t *chip8);
 
 void displ_clear(chip8_t *chip8);
 void displ_present(chip8_t *chip8);
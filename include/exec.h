@@ -0,0 +1,523 @@
+#ifndef _EXEC_H_
+#define _EXEC_H_
+
+#include <stdio.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "gdbstub.h"
+
+/* Instruction semantics, the one switch every way of running a ROM goes
+	through. decode_and_exec() calls it with the fetched opcode, the C
+	that ch8aot writes calls it with a constant, which -O2 folds down to
+	the single case that runs, so compiled ROMs can't drift away from the
+	interpreter.
+
+	Besides the opcode it only runs a breakpoint's trap, tracing and
+	profiling are decode_and_exec()'s. The PC has to point past the
+	instruction already, as after fetch().
+*/
+
+// 8x10 SCHIP/XO-CHIP digits follow the 4x5 ones, FX30
+#define BIG_FONT 0x50
+
+// push to stack and do error checking
+void chip8_push_stack(chip8_t *chip8);
+// pops the last address from the stack and stores it in PC
+void chip8_pop_stack(chip8_t *chip8);
+// copy a range of memory a page at a time, wraps around the end
+void chip8_mem_read(const chip8_t *chip8, uint16_t addr, uint8_t *out, size_t len);
+void chip8_mem_write(chip8_t *chip8, uint16_t addr, const uint8_t *in, size_t len);
+// DXYN on every selected plane, N = 0 is a 16x16 sprite
+void chip8_draw_sprite(chip8_t *chip8, uint8_t X, uint8_t Y, uint8_t N);
+// 00CN, 00DN, 00FB and 00FC on the selected planes, dy > 0 is down and dx > 0 right
+void chip8_scroll(chip8_t *chip8, int dx, int dy);
+
+// skip the next instruction, F000 NNNN is 4 bytes long
+static inline void chip8_skip_instr(chip8_t *chip8) {
+	uint16_t next = chip8_peek16(chip8, chip8->PC);
+	// a breakpoint's trap hides the length of the instruction under it
+	if (next == TRAP_OPCODE && chip8->debugger != NULL) {
+		next = gdb_stub_orig(chip8->debugger, chip8->PC & chip8->mem_mask);
+	}
+	chip8->PC += next == 0xF000 ? 4 : 2;
+}
+
+// run one instruction, always inlined so a constant opcode folds the switch away
+static inline __attribute__((always_inline)) void chip8_exec(chip8_t *chip8, uint16_t op) {
+decode:;
+	uint8_t flag = (op & 0xF000) >> 12;
+	uint8_t X = (op & 0x0F00) >> 8;
+	uint8_t Y = (op & 0x00F0) >> 4;;
+	uint8_t N = op & 0x000F;
+
+	uint8_t NN = op & 0x00FF;
+	uint16_t NNN = op & 0X0FFF;
+
+	#ifdef DEBUG
+	printf("OPCODE: %04x ", op);
+	#endif
+
+	// Parse instructions
+	switch (flag) {
+	case 0x0:
+		// breakpoint patched in by the gdb stub, run the instruction it replaced
+		if (op == TRAP_OPCODE && chip8->debugger != NULL &&
+			(op = chip8->opcode = gdb_stub_trap(chip8->debugger, chip8)) != TRAP_OPCODE) {
+			goto decode;
+		}
+
+		if (op == 0x00E0) {
+			#ifdef DEBUG
+			printf("Clear screen.\n");
+			#endif
+			// only the selected planes
+			for (int plane = 0; plane < DISPLAY_PLANES; plane++) {
+				if (chip8->planes & 1 << plane) memset(chip8->screen[plane], 0, sizeof(chip8->screen[plane]));
+			}
+			chip8->draw = 1;
+		}
+
+		else if (op == 0x00EE) {			
+			#ifdef DEBUG
+			printf("Return to addr %d from stack\n", chip8->stack.array[chip8->stack.size - 1]);
+			#endif
+			chip8_pop_stack(chip8);
+			}
+
+		// SCHIP/XO-CHIP scrolling, down N, up N, right 4 and left 4
+		else if ((op & 0xFFF0) == 0x00C0) chip8_scroll(chip8, 0, N);
+		else if ((op & 0xFFF0) == 0x00D0) chip8_scroll(chip8, 0, -N);
+		else if (op == 0x00FB) chip8_scroll(chip8, 4, 0);
+		else if (op == 0x00FC) chip8_scroll(chip8, -4, 0);
+
+		else if (op == 0x00FD) {
+			#ifdef DEBUG
+			printf("Exit.\n");
+			#endif
+			chip8->running = 0;
+		}
+
+		else if (op == 0x00FE || op == 0x00FF) {
+			#ifdef DEBUG
+			printf("Set %s resolution.\n", N == 0xF ? "high" : "low");
+			#endif
+			// switching clears every plane
+			chip8->hires = N == 0xF;
+			memset(chip8->screen, 0, sizeof(chip8->screen));
+			chip8->draw = 1;
+		}
+
+		else {			
+			#ifdef DEBUG
+			printf("Call machine code to %d.\n", NNN);
+			#endif
+			// store address on the stack 
+			chip8_push_stack(chip8);
+			chip8->PC = NNN;
+		}
+		break;
+	case 0x1: {
+		#ifdef DEBUG
+		printf("JMP to %d. ", NNN);
+		#endif
+		
+		chip8->PC = NNN;
+		break;
+	}
+	case 0x2: {
+		#ifdef DEBUG
+		printf("Call subroutine at: %d\n", NNN);
+		#endif
+
+		chip8_push_stack(chip8);
+		chip8->PC = NNN;
+		break;	
+	}
+	case 0x3: {
+		#ifdef DEBUG
+		printf("Compare: %d == %d (NN) ", 
+			chip8->registers[X], NN);
+		if (chip8->registers[X] == NN) printf("Skipped\n");
+		else printf("\n");
+		#endif
+		// Skips the next instruction if VX equals NN
+		if (chip8->registers[X] == NN) {
+			chip8_skip_instr(chip8);
+		}
+		break;
+		}
+	case 0x4: {
+		#ifdef DEBUG
+		printf("Compare NOT: %d != %d(NN) ", 
+			chip8->registers[X], NN);
+		if (chip8->registers[X] != NN) printf("Skipped\n");
+		else printf("\n");
+		#endif
+
+		// Skip next instruction if NN != Vx
+		if (chip8->registers[X] != NN) {
+			chip8_skip_instr(chip8);
+		}  
+		break;
+		}
+	case 0x5: {
+		if (N == 0x2 || N == 0x3) {
+			#ifdef DEBUG
+			printf("%s V%d to V%d at I\n", N == 0x2 ? "Save" : "Load", X, Y);
+			#endif
+			// XO-CHIP register ranges, backwards if X > Y, I is left alone
+			int step = X <= Y ? 1 : -1;
+			size_t len = (X <= Y ? Y - X : X - Y) + 1;
+			uint8_t buf[16];
+
+			if (N == 0x2) {
+				for (size_t i = 0; i < len; i++) buf[i] = chip8->registers[X + i * step];
+				chip8_mem_write(chip8, chip8->I, buf, len);
+			}
+			else {
+				chip8_mem_read(chip8, chip8->I, buf, len);
+				for (size_t i = 0; i < len; i++) chip8->registers[X + i * step] = buf[i];
+			}
+			if (chip8->debugger) gdb_stub_watch(chip8->debugger, chip8, chip8->I, len, N == 0x2);
+			break;
+		}
+		if (N != 0x0) {
+			fprintf(stderr, "ERROR: ILLEGAL OPCODE in 0x50: %04x\n", op);
+			chip8->running = 0;
+			return;
+		}
+
+		#ifdef DEBUG
+		printf("Compare: %d == %d(Y) ", 
+			chip8->registers[X], chip8->registers[Y]);
+		if (chip8->registers[X] == chip8->registers[Y]) printf("Skipped\n");
+		else printf("\n");
+		#endif
+
+		if (chip8->registers[X] == chip8->registers[Y]) {
+			chip8_skip_instr(chip8);
+		}
+
+		break;
+		}
+	case 0x6: {
+		chip8->registers[X] = NN;\
+
+		#ifdef DEBUG
+		printf("V%d set to %d\n", 
+			X, chip8->registers[X]);
+		#endif
+		
+		break;
+		}
+	case 0x7: {
+		#ifdef DEBUG
+		printf("Add %d to V%d = %d\n", 
+			NN, X, chip8->registers[X]);
+		#endif
+		chip8->registers[X] += NN; 
+		break;
+		}
+	case 0x8: {
+		switch (N) {
+			case 0x0:
+				chip8->registers[X] = chip8->registers[Y];
+				#ifdef DEBUG
+				printf("Set V%d to V%d = %d\n", 
+				X, Y, chip8->registers[X]);
+				#endif
+				break;
+			case 0x1:
+				chip8->registers[X] |= chip8->registers[Y];
+				#ifdef DEBUG
+				printf("bitwise OR V%d to V%d = %d\n", 
+				X, Y, chip8->registers[X]);
+				#endif
+				break;
+			case 0x2:
+				chip8->registers[X] &= chip8->registers[Y];
+				#ifdef DEBUG
+				printf("bitwise AND V%d to V%d = %d\n", 
+				X, Y, chip8->registers[X]);
+				#endif
+				break;
+			case 0x3:
+				chip8->registers[X] ^= chip8->registers[Y];
+				#ifdef DEBUG
+				printf("bitwise XOR V%d to V%d = %d\n", 
+				X, Y, chip8->registers[X]);
+				#endif
+				break;
+			case 0x4: {
+				uint16_t res = chip8->registers[X] + chip8->registers[Y];
+				// max value of a uint8_t 255
+				// check for overflow first
+				if (res > UINT8_MAX) {
+					#ifdef DEBUG
+					printf("overflow detected:  ");
+					#endif		
+					chip8->registers[VF] = 1;
+				}
+				else chip8->registers[VF] = 0;
+				
+				chip8->registers[X] += chip8->registers[Y];
+				
+				#ifdef DEBUG
+				printf("Add V%d to V%d(X) = %d\n", 
+				Y, X, chip8->registers[X]);
+				#endif
+				break;
+				}
+			case 0x5: {
+				// signed to check for underflow
+				int res = chip8->registers[X] - chip8->registers[Y];
+				// max value of a uint8_t 255
+				// check for overflow first
+				if (res < 0) {
+					#ifdef DEBUG
+					printf("underflow detected: ");
+					#endif		
+					chip8->registers[VF] = 0;
+				}
+				else chip8->registers[VF] = 1;
+				
+				chip8->registers[X] -= chip8->registers[Y];
+				
+				#ifdef DEBUG
+				printf("substract V%d from V%d(X) = %d\n", 
+				Y, X, chip8->registers[X]);
+				#endif
+				break;
+			}
+			case 0x6: {
+				// store least significant bit in VF
+				chip8->registers[VF] = chip8->registers[X] & 0x1;
+				chip8->registers[X] >>= 1;
+
+				#ifdef DEBUG
+				printf("Shift V%d >> 1 = %d\n",
+					X, chip8->registers[X]);
+				#endif
+				break;
+			}
+			case 0x7: {
+				int res = chip8->registers[Y] - chip8->registers[X];
+				if (res < 0) {
+					#ifdef DEBUG
+					printf("underflow detected: ");
+					#endif
+					chip8->registers[VF] = 0;
+				}
+				else chip8->registers[VF] = 1;
+				chip8->registers[X] = chip8->registers[Y] - chip8->registers[X];
+				#ifdef DEBUG
+				printf("substract V%d(Y) - V%d = %d\n",
+					Y, X, chip8->registers[X]);
+				#endif
+				break;
+			}
+			case 0x0E: {
+				// store most significant
+				chip8->registers[VF] = chip8->registers[X] & (0x01 << 7);
+				chip8->registers[X] <<= 1;
+				#ifdef DEBUG
+				printf("Shift V%d << 1 = %d\n",
+					X, chip8->registers[X]);
+				#endif
+				break;
+			}
+		}
+		break;
+		}
+
+	case 0x9: {
+		
+		#ifdef DEBUG
+		printf("Skip next V%d != V%d\n",
+			X, Y);
+		#endif
+
+		if (chip8->registers[X] != chip8->registers[Y]) {
+			chip8_skip_instr(chip8);
+		}
+		break;	
+		}
+	case 0xA: {
+		chip8->I = NNN;
+		#ifdef DEBUG
+		printf("Set I to %d\n",
+			chip8->I);
+		#endif
+		break;
+		}
+	case 0xB: {
+		#ifdef DEBUG
+		printf("JMP to (V0) %d + %d = %d\n",
+			chip8->registers[V0], NNN, NNN + chip8->registers[V0]);
+		#endif
+		
+		chip8->PC = chip8->registers[V0] + NNN;
+		break;
+		}
+	case 0xD: {
+		chip8_draw_sprite(chip8, X, Y, N);
+		break;
+		}
+	case 0xE: {
+		if (NN == 0x9E) {
+			#ifdef DEBUG
+				printf("Skip on key %d\n", chip8->registers[X]);
+			#endif
+
+			if ((chip8->keys >> (chip8->registers[X] & 0xF)) & 0x1) {
+				chip8_skip_instr(chip8);
+			}
+		}	
+		else if (NN == 0xA1) {
+			#ifdef DEBUG
+			printf("Skip NOT on key %d\n", chip8->registers[X]);
+			#endif
+
+			if (!((chip8->keys >> (chip8->registers[X] & 0xF)) & 0x1)) {
+				chip8_skip_instr(chip8);
+			}
+		}
+		else {
+			fprintf(stderr, "ERROR: ILLEGAL OPCODE in 0xE0: %04x\n", op);
+			chip8->running = 0;
+			return;
+		}
+		break;
+		}
+	case 0xF: {
+		switch (NN) {
+		case 0x00:
+			if (X != 0) {
+				fprintf(stderr, "ERROR: ILLEGAL OPCODE in 0xF0: %04x\n", op);
+				chip8->running = 0;
+				return;
+			}
+			// XO-CHIP long load, the address is the next word
+			chip8->I = chip8_peek16(chip8, chip8->PC);
+			chip8->PC += 2;
+			#ifdef DEBUG
+			printf("Set I to %d\n", chip8->I);
+			#endif
+			break;
+		case 0x01:
+			#ifdef DEBUG
+			printf("Select planes %d\n", X);
+			#endif
+			chip8->planes = X & 0x3;
+			break;
+		case 0x02:
+			if (X != 0) {
+				fprintf(stderr, "ERROR: ILLEGAL OPCODE in 0xF0: %04x\n", op);
+				chip8->running = 0;
+				return;
+			}
+			#ifdef DEBUG
+			printf("Load audio pattern from %d\n", chip8->I);
+			#endif
+			chip8_mem_read(chip8, chip8->I, chip8->pattern, sizeof(chip8->pattern));
+			if (chip8->debugger) gdb_stub_watch(chip8->debugger, chip8, chip8->I, sizeof(chip8->pattern), 0);
+			break;
+		case 0x07:
+			#ifdef DEBUG
+			printf("Set V%d to timer %d\n", X, chip8->DT);
+			#endif
+			chip8->registers[X] = chip8->DT;
+			break;
+		case 0x0A:
+			// TODO ST and DT should continue
+			#ifdef DEBUG
+			printf("Await input to set V%d to\n", X);
+			#endif
+
+			// halt, the main loop keeps polling input and fetch() holds the PC
+			if (chip8->keys == 0) {
+				chip8->halted = 1;
+				break;
+			}
+			chip8->halted = 0;
+			// lowest key held down
+			chip8->registers[X] = __builtin_ctz(chip8->keys);
+			break;
+		case 0x15:
+			#ifdef DEBUG
+			printf("Set DT to %d\n", chip8->registers[X]);
+			#endif
+			chip8->DT = chip8->registers[X];
+			break;
+		case 0x18:
+			#ifdef DEBUG
+			printf("Set ST to %d\n", chip8->registers[X]);
+			#endif
+			chip8->ST = chip8->registers[X];
+			break;
+		case 0x1E:
+			#ifdef DEBUG
+			printf("Add %d to I = %d\n", chip8->registers[X], chip8->I + chip8->registers[X]);
+			#endif
+			chip8->I += chip8->registers[X];
+			break;
+		case 0x29:
+			#ifdef DEBUG
+			printf("Set I sprite addr: %d\n", chip8->registers[X]);
+			#endif
+			chip8->I = chip8->registers[X] * 0x5;
+			break;
+		case 0x30:
+			#ifdef DEBUG
+			printf("Set I big sprite addr: %d\n", chip8->registers[X]);
+			#endif
+			chip8->I = BIG_FONT + (chip8->registers[X] & 0xF) * 10;
+			break;
+		case 0x33:
+			#ifdef DEBUG
+			printf("set BCD OP\n");
+			#endif
+			chip8_poke(chip8, chip8->I, chip8->registers[X] / 100);
+			chip8_poke(chip8, chip8->I + 1, (chip8->registers[X] / 10) % 10);
+			chip8_poke(chip8, chip8->I + 2, (chip8->registers[X] % 100) % 10);
+			if (chip8->debugger) gdb_stub_watch(chip8->debugger, chip8, chip8->I, 3, 1);
+			break;
+		case 0x55: {
+			#ifdef DEBUG
+			printf("Store from V0 to V%d registers\n", X);
+			#endif
+			chip8_mem_write(chip8, chip8->I, chip8->registers, X + 1);
+			if (chip8->debugger) gdb_stub_watch(chip8->debugger, chip8, chip8->I, X + 1, 1);
+			break;
+		}
+		case 0x65: {
+			#ifdef DEBUG
+			printf("Store from V0 to V%d in memory\n", X);
+			#endif
+			chip8_mem_read(chip8, chip8->I, chip8->registers, X + 1);
+			if (chip8->debugger) gdb_stub_watch(chip8->debugger, chip8, chip8->I, X + 1, 0);
+			break;
+		}
+		case 0x3A:
+			#ifdef DEBUG
+			printf("Set pitch to %d\n", chip8->registers[X]);
+			#endif
+			chip8->pitch = chip8->registers[X];
+			break;
+		default:
+			fprintf(stderr, "ERROR: ILLEGAL OPCODE in 0xF0: %04x\n", op);
+			chip8->running = 0;
+			return;
+		}
+		break;
+	}
+
+	default:
+		fprintf(stderr, "ERROR: UNKNOWN OPCODE: %04x\n", op);
+		chip8->running = 0;
+		return;
+	}
+}
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef _GDBSTUB_H_
+#define _GDBSTUB_H_
+
+#include "chip8.h"
+
+/* GDB remote serial protocol stub, listens on a localhost TCP port or a
+	Unix socket. Breakpoints are set by patching TRAP_OPCODE over the
+	instruction, so the interpreter pays nothing for them until one is hit.
+
+	Registers, in 'g' packet order:
+	0-15 V0-VF (8 bit), 16 I, 17 PC (16 bit, little endian), 18 SP, 19 DT, 20 ST
+	The client reads the same layout from target.xml with qXfer:features:read.
+*/
+
+#define GDB_MAX_BREAKPOINTS 32
+#define GDB_MAX_WATCHPOINTS 8
+// cycles between polls for a client or a ctrl-c
+#define GDB_POLL_CYCLES 1024
+
+// patched over an instruction for a breakpoint, chip8_exec() traps on it in the 0x0 group
+#define TRAP_OPCODE 0x0000
+
+typedef struct gdb_breakpoint {
+	uint16_t addr;
+	uint16_t orig; // instruction that was patched over
+} gdb_breakpoint_t;
+
+enum watch_type {
+	WATCH_WRITE = 2,	// matches the Z packet types
+	WATCH_READ,
+	WATCH_ACCESS
+};
+
+typedef struct gdb_watchpoint {
+	uint16_t addr;
+	uint16_t len;
+	uint8_t type;
+} gdb_watchpoint_t;
+
+typedef struct gdb_stub {
+	int listen_fd;
+	int client_fd;
+
+	gdb_breakpoint_t breakpoints[GDB_MAX_BREAKPOINTS];
+	size_t bp_count;
+	gdb_watchpoint_t watchpoints[GDB_MAX_WATCHPOINTS];
+	size_t wp_count;
+
+	char path[108];			// unix socket to unlink on close, empty for TCP
+
+	uint8_t resumed;		// the client is waiting for a stop reply
+	uint8_t signal;			// reported in the stop reply
+	uint8_t watch_type;		// watchpoint that fired, 0 if none
+	uint16_t watch_addr;
+} gdb_stub_t;
+
+// listen on a port number or a unix socket path, returns 1 on error
+int gdb_stub_open(gdb_stub_t *stub, const char *addr);
+// non-blocking, stops the machine when a client connects or sends a ctrl-c
+void gdb_stub_poll(gdb_stub_t *stub, chip8_t *chip8);
+// called by the core on TRAP_OPCODE, returns the instruction to run instead
+// or TRAP_OPCODE if there is no breakpoint at the current instruction
+uint16_t gdb_stub_trap(gdb_stub_t *stub, chip8_t *chip8);
+// the instruction a breakpoint patched over at addr, TRAP_OPCODE if there is none
+uint16_t gdb_stub_orig(const gdb_stub_t *stub, uint16_t addr);
+// called by the core after an I relative access while a client is attached
+void gdb_stub_watch(gdb_stub_t *stub, chip8_t *chip8, uint16_t addr, uint16_t len, int write);
+// serve the client until it resumes, called by the core when chip8->trapped is set
+void gdb_stub_stop(gdb_stub_t *stub, chip8_t *chip8);
+// the machine's memory was replaced, patch the breakpoints into the new ROM
+void gdb_stub_reload(gdb_stub_t *stub, chip8_t *chip8);
+// remove all breakpoints and drop the client
+void gdb_stub_detach(gdb_stub_t *stub, chip8_t *chip8);
+void gdb_stub_close(gdb_stub_t *stub, chip8_t *chip8);
+
+#endif
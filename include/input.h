@@ -11,26 +11,30 @@
 	A 0 B F -> Z X C V
 
 	Ressembling the original Hex keyboard layout used.
+	The enum values are the hex keys, used as bit numbers in chip8->keys.
 */
 enum keys {
-	K_1 = 1,
-	K_2,
-	K_3,
-	K_4,
-	K_Q,
-	K_W,
-	K_E,
-	K_R,
-	K_A,
-	K_S,
-	K_D,
-	K_F,
-	K_Z,
-	K_X,
-	K_C,
-	K_V
+	K_1 = 0x1,
+	K_2 = 0x2,
+	K_3 = 0x3,
+	K_4 = 0xC,
+	K_Q = 0x4,
+	K_W = 0x5,
+	K_E = 0x6,
+	K_R = 0xD,
+	K_A = 0x7,
+	K_S = 0x8,
+	K_D = 0x9,
+	K_F = 0xE,
+	K_Z = 0xA,
+	K_X = 0x0,
+	K_C = 0xB,
+	K_V = 0xF
 };
 
 // Used for user input
 void handle_input(chip8_t *chip8);
+// random keys held for a few frames each, the same for the same seed,
+// rng is a nonzero xorshift32 state
+uint16_t bot_keys(uint32_t *rng, uint16_t keys);
 #endif
\ No newline at end of file
@@ -0,0 +1,59 @@
+#ifndef _LATENCY_H_
+#define _LATENCY_H_
+
+#include "chip8.h"
+
+/* Input-to-photon latency.
+
+	handle_input() tags every key state change with the time it drained
+	the event. The next displ_present() whose framebuffer differs from the
+	last one presented closes the tag, the time from the tag to the return
+	of SDL_RenderPresent() is one sample. A change that is followed by
+	another before any frame changed, like a release the game ignores,
+	counts as unanswered instead. The percentiles and a histogram are
+	printed at exit.
+
+	For automated runs the injector pushes a synthetic press and release
+	of one key through the SDL event queue every period, a set number of
+	times.
+*/
+
+#define LAT_MAX_SAMPLES 65536
+// histogram buckets in powers of 2 ms, the last one is open ended
+#define LAT_BUCKETS 12
+// cycles between injector clock checks in the main loop
+#define LAT_POLL_CYCLES 256
+
+typedef struct latency {
+	uint64_t pending;		// ns, key change not shown yet, 0 if none
+	uint64_t unanswered;
+	uint64_t dropped;		// samples past LAT_MAX_SAMPLES
+
+	// last presented frame, to tell if the next one changed
+	chip8_row_t screen[DISPLAY_PLANES][DISPLAY_HEIGHT];
+	uint8_t hires;
+
+	uint32_t samples[LAT_MAX_SAMPLES];	// us
+	size_t count;
+
+	// synthetic input, period 0 if off
+	uint32_t inject_ms;
+	uint32_t inject_left;	// presses still to send
+	SDL_Keycode inject_key;
+	uint64_t inject_next;	// ns
+	uint8_t inject_down;
+} latency_t;
+
+// start measuring, inject_ms > 0 also presses key count times, once every inject_ms
+void latency_init(latency_t *lat, uint32_t inject_ms, SDL_Keycode key, uint32_t count);
+// a key state changed, called as handle_input() drains the event
+void latency_key(latency_t *lat);
+// a frame was presented, closes the open tag if the framebuffer changed
+void latency_present(latency_t *lat, const chip8_t *chip8);
+// push the next synthetic key event when it's due, returns 0 once
+// the last press was released and had half a period to show
+int latency_inject(latency_t *lat);
+// print p50/p95/p99 and the histogram
+void latency_report(latency_t *lat);
+
+#endif
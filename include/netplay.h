@@ -0,0 +1,84 @@
+#ifndef _NETPLAY_H_
+#define _NETPLAY_H_
+
+#include <netinet/in.h>
+
+#include "chip8.h"
+
+/* Two player rollback netplay over UDP.
+
+	Both peers run the same ROM in lockstep, one frame at a time. The keys
+	of a frame are the OR of both players' bitmasks. The remote bitmask is
+	predicted as the last one received. Every frame starts with a snapshot,
+	and when a remote input arrives that differs from the prediction the
+	machine is rolled back to that frame and the frames since are run again.
+
+	Every packet carries all local inputs the peer hasn't acknowledged,
+	so lost packets only cost latency. The peers also exchange the hash of
+	their latest confirmed frame to catch desyncs.
+
+	For testing on one box the outgoing link can be delayed and lossy.
+*/
+
+#define NET_FPS 60
+// the local input is applied this many frames late, hides small latencies
+#define NET_INPUT_DELAY 2
+// frames the simulation may run ahead of the remote input before it stalls
+#define NET_MAX_ROLLBACK 16
+// frames kept for inputs and snapshots, a power of 2 > 2 * NET_MAX_ROLLBACK + 2 * NET_INPUT_DELAY
+#define NET_RING 64
+// packets held back by the simulated link
+#define NET_QUEUE 256
+// header plus a full ring of inputs
+#define NET_PACKET_MAX (24 + NET_RING * 2)
+
+typedef struct net_delayed {
+	uint64_t due;	// ns
+	size_t len;
+	uint8_t data[NET_PACKET_MAX];
+} net_delayed_t;
+
+typedef struct netplay {
+	int fd;
+	struct sockaddr_in peer;
+
+	uint32_t frame;				// next frame to run
+	uint32_t remote_confirmed;	// remote input is known for frames below this
+	uint32_t remote_ack;		// the peer has our input for frames below this
+	uint32_t rollback_from;		// earliest mispredicted frame, UINT32_MAX if none
+
+	uint16_t local[NET_RING];	// local input by frame
+	uint16_t remote[NET_RING];	// remote input by frame, confirmed or predicted
+	chip8_state_t states[NET_RING];	// machine at the start of each frame, freed by net_close()
+
+	// last sync hash received from the peer
+	uint32_t sync_frame;
+	uint32_t sync_hash;
+	uint8_t sync_pending;
+
+	// simulated link, applied to outgoing packets
+	uint32_t latency_ms;
+	uint32_t jitter_ms;
+	uint32_t loss_pct;
+	uint32_t rng;
+	net_delayed_t queue[NET_QUEUE];
+	size_t queued;
+
+	// stats
+	uint64_t rollbacks;
+	uint64_t resim_frames;
+	uint64_t resim_ns;
+	uint64_t stalls;
+	uint64_t desyncs;
+} netplay_t;
+
+// bind to local_port and talk to "host:port", returns 1 on error
+int net_open(netplay_t *net, const char *local_port, const char *remote);
+// run one frame with the local keys, rolling back first if a late input
+// arrived, returns 0 if the frame was skipped waiting on the peer. Running
+// out of memory for a snapshot stops the machine
+int net_frame(netplay_t *net, chip8_t *chip8, uint16_t keys);
+// keep resending the last inputs for a moment, then print the stats
+void net_close(netplay_t *net);
+
+#endif
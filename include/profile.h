@@ -0,0 +1,57 @@
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include "chip8.h"
+
+/* ROM profiler. Every instruction bumps a flat counter indexed by its
+	address, that's all the loop does unless the stack size changed.
+
+	Calls and returns are found from stack.size, a push on 2NNN (or a
+	0NNN call) enters a routine at the new PC, a pop on 00EE leaves it.
+	They move through a calling context tree, a node per distinct chain
+	of routines, each with the instructions run while it was on top.
+	Inclusive and exclusive counts per routine and the folded stacks
+	all come out of the tree at the end, recursion counted once.
+
+	At exit <prefix>.asm gets the routine table and an annotated
+	disassembly of every address that ran, <prefix>.folded one line per
+	call chain for flamegraph.pl and the like. The disassembly reads the
+	memory as it was at the end.
+*/
+
+typedef struct profile_node {
+	uint16_t routine;		// entry address
+	uint32_t parent;
+	uint32_t child;			// first child, 0 if none, the root is never a child
+	uint32_t sibling;
+	uint64_t self;			// instructions run with this node on top
+} profile_node_t;
+
+typedef struct profile {
+	uint64_t *counts;		// instructions run at each address, SYS_MEMORY of them
+	uint64_t *calls;		// calls into each address
+	uint64_t instr;
+
+	profile_node_t *nodes;
+	size_t node_count;
+	size_t node_cap;
+	uint32_t current;		// node on top of the stack
+	size_t depth;			// its stack.size
+	uint64_t mark;			// instr when it last got on top
+} profile_t;
+
+// start counting, the routine at the current PC is the root, returns 1 on error
+int profile_open(profile_t *prof, const chip8_t *chip8);
+// the stack size changed, move through the tree
+void profile_stack(profile_t *prof, const chip8_t *chip8);
+// write <prefix>.asm and <prefix>.folded and free everything
+void profile_close(profile_t *prof, const chip8_t *chip8, const char *prefix);
+
+// called by the core after every instruction, depth is stack.size before it
+static inline void profile_exec(profile_t *prof, const chip8_t *chip8, uint16_t addr, size_t depth) {
+	prof->counts[addr]++;
+	prof->instr++;
+	if (chip8->stack.size != depth) profile_stack(prof, chip8);
+}
+
+#endif
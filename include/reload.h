@@ -0,0 +1,36 @@
+#ifndef _RELOAD_H_
+#define _RELOAD_H_
+
+#include <stdint.h>
+
+#include "chip8.h"
+
+/* ROM hot-reload. inotify watches the ROM's directory rather than the
+	file, build tools often write a new file and rename it over the old
+	one, which would leave a watch on the file pointing at the old inode.
+	A reload is a chip8_load_rom() onto the running machine, the SDL or
+	terminal front-end is left alone.
+*/
+
+// cycles between polls of the inotify descriptor, well under a frame
+#define RELOAD_POLL_CYCLES 2048
+
+typedef struct reload {
+	int fd;					// -1 if not watching
+	int wd;
+	const char *path;
+	char name[256];			// the ROM's file name in the watched directory
+	// stats
+	uint64_t reloads;
+	uint64_t slowest_ns;
+} reload_t;
+
+// start watching, returns 1 on error
+int reload_open(reload_t *reload, const char *path);
+// non-blocking, reloads the ROM into the machine if it was rewritten since
+// the last call, returns 1 if it did
+int reload_poll(reload_t *reload, chip8_t *chip8);
+// stop watching and print the stats
+void reload_close(reload_t *reload);
+
+#endif
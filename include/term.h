@@ -0,0 +1,61 @@
+#ifndef _TERM_H_
+#define _TERM_H_
+
+#include <termios.h>
+
+#include "chip8.h"
+
+/* Terminal front-end, an alternative to display.c and input.c for boxes
+	without a display. Pixels are drawn with Unicode half blocks (1x2 per
+	cell) or braille (2x4 per cell) and only the cells that changed since
+	the last frame are written. Pixels lit on any XO-CHIP plane are drawn.
+
+	Terminals have no key up events. A fresh press counts as held for
+	TERM_KEY_DELAY_MS, longer than the usual autorepeat delay, and once the
+	key repeats until TERM_KEY_HOLD_MS pass without another repeat.
+
+	The terminal is restored if the process is killed by SIGINT, SIGTERM,
+	SIGHUP or SIGQUIT while it's in raw mode.
+*/
+
+#define TERM_FPS 30
+// first repeat, autorepeat delays are commonly 250-600 ms
+#define TERM_KEY_DELAY_MS 700
+// between repeats
+#define TERM_KEY_HOLD_MS 150
+// cycles between clock checks in the main loop
+#define TERM_POLL_CYCLES 256
+
+// cells of the largest mode, hires half blocks
+#define TERM_ROWS (DISPLAY_HEIGHT / 2)
+#define TERM_COLS DISPLAY_WIDTH
+
+enum term_mode {
+	TERM_HALFBLOCK = 0,
+	TERM_BRAILLE
+};
+
+typedef struct term {
+	struct termios saved;
+	uint8_t mode;
+
+	// glyph of every cell on the terminal, used to diff the next frame
+	uint8_t cells[TERM_ROWS][TERM_COLS];
+	chip8_row_t screen[DISPLAY_PLANES][DISPLAY_HEIGHT];
+	uint8_t valid;			// 0 until the first full frame is drawn
+	uint8_t hires;			// resolution of the last frame
+	int rows;				// cells of the last frame
+
+	uint64_t last_frame;	// ns
+	uint64_t key_time[16];	// ns, when each held key last repeated
+	uint16_t repeating;		// bit n is set once held key n has repeated
+} term_t;
+
+// switch stdin to raw mode and clear the terminal, returns 1 if stdin is not a tty
+int term_init(term_t *term, int mode);
+// read pending keys and redraw the changed cells, rate limited to TERM_FPS
+void term_update(term_t *term, chip8_t *chip8);
+// restore the terminal
+void term_destroy(term_t *term);
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "chip8.h"
+
+/* Binary execution trace, a few bytes per instruction instead of the
+	DEBUG printf stream.
+
+	The file is "C8TR" and a version, then blocks. Every block starts
+	with a keyframe of the machine, so decoding can start at any block:
+
+	magic		"C8BK"
+	length		u32, of the whole block
+	records		u32
+	keyframe	instructions and frames before the block, PC, I, V0-VF,
+				stack, DT, ST, planes, resolution and the screen
+
+	followed by one record per instruction, every field but the first
+	two only there if its flag is set:
+
+	flags		1 byte, TRACE_*
+	PC			zigzag varint, from the address after the last instruction
+	opcode		2 bytes big endian
+	I			zigzag varint, change of I
+	registers	varint mask of the changed registers, then their values
+	sprite		varint length, then the bytes DXYN drew
+	timers		DT and ST
+
+	A TRACE_FRAME record marks a 60 Hz timer tick, it has no PC or
+	opcode and always carries the timers. Multi-byte integers are little
+	endian, screen rows are 16 bytes with pixel 0 in the top bit.
+
+	The emulator fills a block in memory and hands it to a writer thread,
+	it only waits if all TRACE_BLOCKS buffers are queued.
+*/
+
+#define TRACE_VERSION 1
+#define TRACE_BLOCK_SIZE 65536
+#define TRACE_BLOCKS 4
+// longest record, 2 planes of a 16x16 sprite and every register
+#define TRACE_RECORD_MAX 96
+// block header plus keyframe
+#define TRACE_KEYFRAME_SIZE (12 + 8 + 4 + 2 + 2 + 16 + 1 + 32 + 4 + DISPLAY_PLANES * DISPLAY_HEIGHT * 16)
+
+enum trace_flags {
+	TRACE_PC = 0x01,
+	TRACE_I = 0x02,
+	TRACE_REGS = 0x04,
+	TRACE_SPRITE = 0x08,
+	TRACE_TIMERS = 0x10,
+	TRACE_FRAME = 0x20
+};
+
+typedef struct trace_block {
+	uint8_t data[TRACE_BLOCK_SIZE];
+	size_t len;
+	uint32_t records;
+} trace_block_t;
+
+typedef struct trace {
+	FILE *fp;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	trace_block_t blocks[TRACE_BLOCKS];
+	size_t head;	// block being filled
+	size_t tail;	// next block to write
+	size_t queued;	// blocks waiting for the writer
+	uint8_t done;
+
+	// the machine as of the last record, records only hold the changes
+	uint16_t pc;	// expected address of the next instruction
+	uint16_t I;
+	uint8_t registers[16];
+	uint8_t DT;
+	uint8_t ST;
+	uint64_t instr;
+	uint32_t frame;
+
+	// bytes drawn by the instruction being run
+	uint8_t sprite[64];
+	size_t sprite_len;
+
+	// stats
+	uint64_t bytes;
+	uint64_t stalls;
+} trace_t;
+
+// A record as decoded by the reader
+typedef struct trace_record {
+	uint64_t instr;
+	uint32_t frame;
+	uint8_t flags;
+	uint16_t PC;
+	uint16_t opcode;
+	uint16_t regs;		// bitmask of the registers the instruction changed
+	uint8_t sprite_len;
+} trace_record_t;
+
+typedef struct trace_reader {
+	FILE *fp;
+	// index of the blocks, built on open
+	long *offsets;
+	uint32_t *frames;	// frames before each block
+	size_t blocks;
+	size_t block;		// current block
+
+	uint8_t *data;
+	size_t len;
+	size_t pos;
+	uint32_t left;		// records left in the block
+
+	// the machine rebuilt from the trace, screen included
+	chip8_t machine;
+	uint64_t instr;
+	uint32_t frame;
+} trace_reader_t;
+
+// create the file and start the writer, the first keyframe is the current machine
+int trace_open(trace_t *trace, const char *path, const chip8_t *chip8);
+// write out what's left, stop the writer and print the stats
+void trace_close(trace_t *trace);
+
+// hooks called by the core
+void trace_exec(trace_t *trace, const chip8_t *chip8, uint16_t addr, uint16_t opcode);
+void trace_sprite(trace_t *trace, const uint8_t *sprite, size_t len);
+void trace_frame(trace_t *trace, const chip8_t *chip8);
+
+// index the blocks of a trace file, returns 1 on error
+int trace_reader_open(trace_reader_t *reader, const char *path);
+// decode the next record and apply it to reader->machine,
+// returns 0 at the end of the trace and -1 if it's corrupt
+int trace_reader_next(trace_reader_t *reader, trace_record_t *rec);
+// go to the end of a frame through the nearest keyframe, returns 1 past the end
+int trace_reader_seek(trace_reader_t *reader, uint32_t frame);
+void trace_reader_close(trace_reader_t *reader);
+
+#endif
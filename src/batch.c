@@ -0,0 +1,383 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "../include/batch.h"
+
+_Static_assert(BATCH_LANES == 16, "the mask helpers read 16 lanes as two words");
+
+// any lane set
+static int any(batch_m8 m);
+// lowest lane set, -1 if none
+static int first(batch_m8 m);
+static int count(batch_m8 m);
+static inline batch_m16 wide(batch_m8 m) {
+	return __builtin_convertvector(m, batch_m16);
+}
+static inline batch_m8 narrow(batch_m16 m) {
+	return __builtin_convertvector(m, batch_m8);
+}
+// a in the masked lanes, b in the rest
+static inline batch_u8 sel8(batch_m8 m, batch_u8 a, batch_u8 b) {
+	return (a & (batch_u8)m) | (b & ~(batch_u8)m);
+}
+static inline batch_u16 sel16(batch_m16 m, batch_u16 a, batch_u16 b) {
+	return (a & (batch_u16)m) | (b & ~(batch_u16)m);
+}
+
+// the word at addr if it is the same on every lane, -1 if a lane wrote there
+static int shared_word(const batch_t *batch, uint16_t addr);
+// the instruction at pc, lanes of the group with a different one are dropped from it
+static uint16_t fetch_group(batch_t *batch, int leader, uint16_t pc, batch_m8 *group);
+// run one instruction on the group with vector ops, returns 0 if it needs the core
+static int exec_vector(batch_t *batch, uint16_t op, uint16_t pc, batch_m8 m8);
+// skip the next instruction on the lanes in cond, F000 NNNN is 4 bytes long
+static void skip(batch_t *batch, uint16_t pc, batch_m8 cond);
+// FX33, FX55 and FX65 on one lane
+static void mem_op(batch_t *batch, int lane, uint8_t NN, uint8_t X);
+// the lane wrote at addr, instructions there can't be fetched once for every lane
+static void mark_written(batch_t *batch, int lane, uint16_t addr);
+// run one instruction on one lane through the core
+static void exec_scalar(batch_t *batch, int lane, uint16_t op, uint16_t pc);
+// the lane's registers into its chip8_t, the stack only if asked
+static void store(batch_t *batch, int lane, int stack);
+
+int batch_init(batch_t *batch, chip8_image_t *image, size_t count) {
+	if (count > BATCH_LANES) {
+		fprintf(stderr, "Error, a batch holds at most %d machines\n", BATCH_LANES);
+		return 1;
+	}
+	memset(batch, 0, sizeof(batch_t));
+	batch->count = count;
+
+	for (size_t lane = 0; lane < BATCH_LANES; lane++) {
+		chip8_attach(&batch->lanes[lane], image);
+		if (lane >= count) batch->lanes[lane].running = 0;
+		batch_load(batch, lane);
+	}
+	return 0;
+}
+
+void batch_run_frame(batch_t *batch, size_t cycles) {
+	batch_u16 left = (batch_u16)wide(batch->running) & (uint16_t)cycles;
+	// every lane runs the same image, so in the same mode
+	uint16_t mask = batch->lanes[0].mem_mask;
+
+	for (;;) {
+		batch_m8 active = narrow(left != 0);
+		int leader = first(active);
+		if (leader < 0) break;
+
+		// converged is the common case, otherwise the lowest PC goes first
+		uint16_t pc = batch->PC[leader];
+		batch_m8 group = active & narrow(batch->PC == pc);
+		if (any(active & ~group)) {
+			for (int lane = leader + 1; lane < BATCH_LANES; lane++) {
+				if (active[lane] && batch->PC[lane] < pc) {
+					pc = batch->PC[lane];
+					leader = lane;
+				}
+			}
+			group = active & narrow(batch->PC == pc);
+		}
+
+		uint16_t op = fetch_group(batch, leader, pc, &group);
+		batch->steps++;
+		if (exec_vector(batch, op, pc, group)) {
+			batch->vector_instr += count(group);
+		}
+		else {
+			for (int lane = 0; lane < BATCH_LANES; lane++) {
+				if (group[lane]) exec_scalar(batch, lane, op, pc);
+			}
+		}
+
+		// as fetch() wraps the PC
+		batch->PC &= mask;
+		left += (batch_u16)wide(group);
+		// a lane stopped by an error runs no more
+		left &= (batch_u16)wide(batch->running);
+	}
+
+	// 60 Hz timers, on every lane like chip8_run_frame()
+	batch->DT += (batch_u8)(batch->DT != 0);
+	batch->ST += (batch_u8)(batch->ST != 0);
+}
+
+chip8_t *batch_lane(batch_t *batch, size_t lane) {
+	chip8_t *chip8 = &batch->lanes[lane];
+
+	store(batch, lane, 1);
+	// as fetch() left it
+	chip8->PC = batch->PC[lane] + 2;
+	chip8->opcode = chip8_peek16(chip8, batch->PC[lane]);
+	return chip8;
+}
+
+void batch_load(batch_t *batch, size_t lane) {
+	chip8_t *chip8 = &batch->lanes[lane];
+
+	for (int x = 0; x < 16; x++) batch->V[x][lane] = chip8->registers[x];
+	batch->PC[lane] = chip8->PC - 2;
+	batch->I[lane] = chip8->I;
+	batch->DT[lane] = chip8->DT;
+	batch->ST[lane] = chip8->ST;
+	batch->keys[lane] = chip8->keys;
+	for (int i = 0; i < 16; i++) batch->stack[i][lane] = chip8->stack.array[i];
+	batch->SP[lane] = chip8->stack.size;
+	batch->running[lane] = chip8->running ? -1 : 0;
+
+	// private pages the caller wrote
+	for (size_t i = 0; i < PAGE_COUNT; i++) batch->written[i] |= chip8->dirty[i];
+}
+
+void batch_free(batch_t *batch) {
+	for (size_t lane = 0; lane < BATCH_LANES; lane++) chip8_detach(&batch->lanes[lane]);
+}
+
+static int any(batch_m8 m) {
+	uint64_t w[2];
+	memcpy(w, &m, sizeof(w));
+	return (w[0] | w[1]) != 0;
+}
+
+static int first(batch_m8 m) {
+	uint64_t w[2];
+	memcpy(w, &m, sizeof(w));
+	if (w[0]) return __builtin_ctzll(w[0]) / 8;
+	if (w[1]) return 8 + __builtin_ctzll(w[1]) / 8;
+	return -1;
+}
+
+static int count(batch_m8 m) {
+	uint64_t w[2];
+	memcpy(w, &m, sizeof(w));
+	return (__builtin_popcountll(w[0]) + __builtin_popcountll(w[1])) / 8;
+}
+
+static int shared_word(const batch_t *batch, uint16_t addr) {
+	uint16_t mask = batch->lanes[0].mem_mask;
+	if (batch->written[(addr & mask) / PAGE_SIZE] || batch->written[((addr + 1) & mask) / PAGE_SIZE]) return -1;
+	return chip8_peek16(&batch->lanes[0], addr);
+}
+
+static uint16_t fetch_group(batch_t *batch, int leader, uint16_t pc, batch_m8 *group) {
+	int word = shared_word(batch, pc);
+	if (word >= 0) return word;
+
+	uint16_t op = chip8_peek16(&batch->lanes[leader], pc);
+	for (int lane = 0; lane < BATCH_LANES; lane++) {
+		// run next time around, with its own group
+		if ((*group)[lane] && chip8_peek16(&batch->lanes[lane], pc) != op) (*group)[lane] = 0;
+	}
+	return op;
+}
+
+static void skip(batch_t *batch, uint16_t pc, batch_m8 cond) {
+	if (!any(cond)) return;
+
+	int word = shared_word(batch, pc + 2);
+	if (word >= 0) {
+		batch->PC += (batch_u16)wide(cond) & (uint16_t)(word == 0xF000 ? 4 : 2);
+		return;
+	}
+	for (int lane = 0; lane < BATCH_LANES; lane++) {
+		if (cond[lane]) batch->PC[lane] += chip8_peek16(&batch->lanes[lane], pc + 2) == 0xF000 ? 4 : 2;
+	}
+}
+
+static int exec_vector(batch_t *batch, uint16_t op, uint16_t pc, batch_m8 m8) {
+	uint8_t X = (op & 0x0F00) >> 8;
+	uint8_t Y = (op & 0x00F0) >> 4;
+	uint8_t N = op & 0x000F;
+	uint8_t NN = op & 0x00FF;
+	uint16_t NNN = op & 0x0FFF;
+	batch_m16 m16 = wide(m8);
+	batch_u8 *V = batch->V;
+	batch_u8 vx = V[X], vy = V[Y];
+	batch_u16 next = batch->PC + 2;
+
+	switch (op >> 12) {
+	case 0x0:
+		if (op != 0x00EE || any(m8 & (batch->SP == 0))) return 0;
+		batch->SP += (batch_u8)m8;
+		for (int lane = 0; lane < BATCH_LANES; lane++) {
+			if (m8[lane]) batch->PC[lane] = batch->stack[batch->SP[lane]][lane];
+		}
+		return 1;
+	case 0x1:
+		batch->PC = sel16(m16, (batch_u16){0} + NNN, batch->PC);
+		return 1;
+	case 0x2:
+		// overflow is reported by the core
+		if (any(m8 & (batch->SP >= 15))) return 0;
+		for (int lane = 0; lane < BATCH_LANES; lane++) {
+			if (m8[lane]) batch->stack[batch->SP[lane]][lane] = pc + 2;
+		}
+		batch->SP -= (batch_u8)m8;
+		batch->PC = sel16(m16, (batch_u16){0} + NNN, batch->PC);
+		return 1;
+	case 0x3:
+		batch->PC = sel16(m16, next, batch->PC);
+		skip(batch, pc, m8 & (vx == NN));
+		return 1;
+	case 0x4:
+		batch->PC = sel16(m16, next, batch->PC);
+		skip(batch, pc, m8 & (vx != NN));
+		return 1;
+	case 0x5:
+		if (N != 0x0) return 0;
+		batch->PC = sel16(m16, next, batch->PC);
+		skip(batch, pc, m8 & (vx == vy));
+		return 1;
+	case 0x6:
+		V[X] = sel8(m8, (batch_u8){0} + NN, vx);
+		break;
+	case 0x7:
+		V[X] = vx + ((batch_u8)m8 & NN);
+		break;
+	case 0x8:
+		// VF is written first, the result reads it back if X or Y is F
+		switch (N) {
+		case 0x0: V[X] = sel8(m8, vy, vx); break;
+		case 0x1: V[X] = vx | (vy & (batch_u8)m8); break;
+		case 0x2: V[X] = vx & (vy | ~(batch_u8)m8); break;
+		case 0x3: V[X] = vx ^ (vy & (batch_u8)m8); break;
+		case 0x4:
+			V[VF] = sel8(m8, (batch_u8)(vx + vy < vx) & 1, V[VF]);
+			V[X] = sel8(m8, V[X] + V[Y], V[X]);
+			break;
+		case 0x5:
+			V[VF] = sel8(m8, (batch_u8)(vx >= vy) & 1, V[VF]);
+			V[X] = sel8(m8, V[X] - V[Y], V[X]);
+			break;
+		case 0x6:
+			V[VF] = sel8(m8, vx & 1, V[VF]);
+			V[X] = sel8(m8, V[X] >> 1, V[X]);
+			break;
+		case 0x7:
+			V[VF] = sel8(m8, (batch_u8)(vy >= vx) & 1, V[VF]);
+			V[X] = sel8(m8, V[Y] - V[X], V[X]);
+			break;
+		case 0xE:
+			V[VF] = sel8(m8, vx & 0x80, V[VF]);
+			V[X] = sel8(m8, V[X] << 1, V[X]);
+			break;
+		}
+		break;
+	case 0x9:
+		batch->PC = sel16(m16, next, batch->PC);
+		skip(batch, pc, m8 & (vx != vy));
+		return 1;
+	case 0xA:
+		batch->I = sel16(m16, (batch_u16){0} + NNN, batch->I);
+		break;
+	case 0xB:
+		batch->PC = sel16(m16, __builtin_convertvector(V[V0], batch_u16) + NNN, batch->PC);
+		return 1;
+	case 0xE: {
+		if (NN != 0x9E && NN != 0xA1) return 0;
+		batch_u16 held = batch->keys >> (__builtin_convertvector(vx, batch_u16) & 0xF) & 1;
+		batch_m8 cond = narrow(NN == 0x9E ? held != 0 : held == 0);
+		batch->PC = sel16(m16, next, batch->PC);
+		skip(batch, pc, m8 & cond);
+		return 1;
+	}
+	case 0xF:
+		switch (NN) {
+		case 0x07: V[X] = sel8(m8, batch->DT, vx); break;
+		case 0x15: batch->DT = sel8(m8, vx, batch->DT); break;
+		case 0x18: batch->ST = sel8(m8, vx, batch->ST); break;
+		case 0x1E:
+			batch->I += (batch_u16)m16 & __builtin_convertvector(vx, batch_u16);
+			break;
+		case 0x29:
+			batch->I = sel16(m16, __builtin_convertvector(vx, batch_u16) * 5, batch->I);
+			break;
+		case 0x33:
+		case 0x55:
+		case 0x65:
+			// memory is per lane, but these don't need the whole machine synced
+			for (int lane = 0; lane < BATCH_LANES; lane++) {
+				if (m8[lane]) mem_op(batch, lane, NN, X);
+			}
+			break;
+		default:
+			return 0;
+		}
+		break;
+	default:
+		return 0;
+	}
+
+	batch->PC = sel16(m16, next, batch->PC);
+	return 1;
+}
+
+static void mem_op(batch_t *batch, int lane, uint8_t NN, uint8_t X) {
+	chip8_t *chip8 = &batch->lanes[lane];
+	uint16_t I = batch->I[lane];
+	uint8_t vx = batch->V[X][lane];
+
+	if (NN == 0x33) {
+		chip8_poke(chip8, I, vx / 100);
+		chip8_poke(chip8, I + 1, (vx / 10) % 10);
+		chip8_poke(chip8, I + 2, vx % 10);
+	}
+	else if (NN == 0x55) {
+		for (int x = 0; x <= X; x++) chip8_poke(chip8, I + x, batch->V[x][lane]);
+	}
+	else {
+		for (int x = 0; x <= X; x++) batch->V[x][lane] = chip8_peek(chip8, I + x);
+		return;
+	}
+	mark_written(batch, lane, I);
+}
+
+static void mark_written(batch_t *batch, int lane, uint16_t addr) {
+	// every write is at most 16 bytes from I
+	addr &= batch->lanes[lane].mem_mask;
+	uint16_t last = (addr + 15) & batch->lanes[lane].mem_mask;
+	if (batch->lanes[lane].dirty[addr / PAGE_SIZE]) batch->written[addr / PAGE_SIZE] = 1;
+	if (batch->lanes[lane].dirty[last / PAGE_SIZE]) batch->written[last / PAGE_SIZE] = 1;
+}
+
+static void exec_scalar(batch_t *batch, int lane, uint16_t op, uint16_t pc) {
+	chip8_t *chip8 = &batch->lanes[lane];
+	uint16_t I = batch->I[lane];
+
+	// only 0NNN, 00EE and 2NNN touch the stack
+	int stack = op >> 12 == 0x0 || op >> 12 == 0x2;
+
+	store(batch, lane, stack);
+	chip8->PC = pc + 2;
+	chip8->opcode = op;
+	decode_and_exec(chip8);
+	batch->scalar_instr++;
+
+	for (int x = 0; x < 16; x++) batch->V[x][lane] = chip8->registers[x];
+	// fetch() holds the PC while FX0A waits
+	batch->PC[lane] = chip8->halted ? chip8->PC - 2 : chip8->PC;
+	batch->I[lane] = chip8->I;
+	batch->DT[lane] = chip8->DT;
+	batch->ST[lane] = chip8->ST;
+	if (stack) {
+		for (int i = 0; i < 16; i++) batch->stack[i][lane] = chip8->stack.array[i];
+		batch->SP[lane] = chip8->stack.size;
+	}
+	batch->running[lane] = chip8->running ? -1 : 0;
+
+	mark_written(batch, lane, I);
+}
+
+static void store(batch_t *batch, int lane, int stack) {
+	chip8_t *chip8 = &batch->lanes[lane];
+
+	for (int x = 0; x < 16; x++) chip8->registers[x] = batch->V[x][lane];
+	chip8->I = batch->I[lane];
+	chip8->DT = batch->DT[lane];
+	chip8->ST = batch->ST[lane];
+	chip8->keys = batch->keys[lane];
+	if (!stack) return;
+	for (int i = 0; i < 16; i++) chip8->stack.array[i] = batch->stack[i][lane];
+	chip8->stack.size = batch->SP[lane];
+}
@@ -1,15 +1,23 @@
 #include <stdio.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "../include/chip8.h"
 #include "../include/input.h"
 #include "../include/display.h"
+#include "../include/gdbstub.h"
+#include "../include/trace.h"
+#include "../include/profile.h"
+#include "../include/exec.h"
 
 #define PC_START 0x200
-#define MEM_END  0xFFF
 
-uint8_t fonts[] = {
+#define FONTS_LEN 240
+
+// fonts at 0x000, mapped by every machine without a ROM attached, never freed
+static chip8_image_t font_image = { .memory = {
 	0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
 	0x20, 0x60, 0x20, 0x20, 0x70, // 1
 	0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
@@ -26,27 +34,69 @@ uint8_t fonts[] = {
 	0xE0, 0x90, 0x90, 0x90, 0xE0, // D
 	0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
 	0xF0, 0x80, 0xF0, 0x80, 0x80, // F
-};
+	0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+	0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+	0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+	0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+	0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+	0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+	0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+	0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+	0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+	0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+	0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+	0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0, // F
+} };
 
 
 static void store_instr(chip8_t *chip8);
-// push to stack and do error checking
-static void push_stack(chip8_t *chip8);
-// pops the last address from the stack and stores it in PC
-static void pop_stack(chip8_t *chip8);
-
-// validation
-static void validate_NNN(chip8_t *chip8, uint16_t NNN);
-static void validate_X(chip8_t *chip8, uint8_t X);
-static void validate_XY(chip8_t *chip8, uint8_t X, uint8_t Y);
+// free the private pages and map the image back in
+static void map_image(chip8_t *chip8);
+// decode_and_exec() without and with the trace and profile hooks
+static void exec_plain(chip8_t *chip8);
+static void exec_hooked(chip8_t *chip8);
+// give the machine its own copy of a page, returns NULL if out of memory
+static uint8_t *own_page(chip8_t *chip8, uint16_t page);
 
 static void store_instr(chip8_t *chip8) {
 	// Reverse endian, store in union's largest value
-	chip8->opcode = 
-		(chip8->memory[chip8->PC] << 8) + chip8->memory[chip8->PC+1];
+	chip8->opcode = chip8_peek16(chip8, chip8->PC);
+}
+
+void chip8_poke(chip8_t *chip8, uint16_t addr, uint8_t val) {
+	addr &= chip8->mem_mask;
+	uint16_t page = addr / PAGE_SIZE;
+
+	if (!chip8->dirty[page] && own_page(chip8, page) == NULL) return;
+	chip8->pages[page][addr % PAGE_SIZE] = val;
+}
+
+static uint8_t *own_page(chip8_t *chip8, uint16_t page) {
+	uint8_t *copy = malloc(PAGE_SIZE);
+	if (copy == NULL) {
+		fprintf(stderr, "Error allocating memory page %d!\n", page);
+		chip8->running = 0;
+		return NULL;
+	}
+	memcpy(copy, chip8->pages[page], PAGE_SIZE);
+	chip8->pages[page] = copy;
+	chip8->dirty[page] = 1;
+	return copy;
+}
+
+static void map_image(chip8_t *chip8) {
+	for (size_t i = 0; i < PAGE_COUNT; i++) {
+		if (chip8->dirty[i]) free(chip8->pages[i]);
+		chip8->dirty[i] = 0;
+		chip8->pages[i] = chip8->image->memory + i * PAGE_SIZE;
+	}
 }
 
-static void push_stack(chip8_t *chip8) {
+void chip8_push_stack(chip8_t *chip8) {
 	if (chip8->stack.size >= 15) {
 		fprintf(stderr, "Stack overflow Error!\n");
 		chip8->running = 0;
@@ -60,7 +110,7 @@ static void push_stack(chip8_t *chip8) {
 	#endif
 }
 
-static void pop_stack(chip8_t *chip8) {
+void chip8_pop_stack(chip8_t *chip8) {
 	if (chip8->stack.size == 0) {
 		fprintf(stderr, "Stack underflow Error!\n");
 		chip8->running = 0;
@@ -73,37 +123,127 @@ static void pop_stack(chip8_t *chip8) {
 	#endif
 }
 
-int init(chip8_t *chip8, char *rom_path) {
-	if (chip8 == NULL || rom_path == NULL) {
-		return 1;
+void chip8_mem_read(const chip8_t *chip8, uint16_t addr, uint8_t *out, size_t len) {
+	while (len > 0) {
+		addr &= chip8->mem_mask;
+		size_t n = PAGE_SIZE - addr % PAGE_SIZE;
+		if (n > len) n = len;
+		memcpy(out, &chip8->pages[addr / PAGE_SIZE][addr % PAGE_SIZE], n);
+		out += n;
+		addr += n;
+		len -= n;
 	}
+}
 
-	if (displ_init_SDL()) return 1;
-	chip8->window = displ_init_Window();
-	chip8->renderer = displ_init_Renderer(chip8->window);
-	chip8->texture = displ_init_Texture(chip8->renderer);
+void chip8_mem_write(chip8_t *chip8, uint16_t addr, const uint8_t *in, size_t len) {
+	while (len > 0) {
+		addr &= chip8->mem_mask;
+		uint16_t page = addr / PAGE_SIZE;
+		size_t n = PAGE_SIZE - addr % PAGE_SIZE;
+		if (n > len) n = len;
+		if (!chip8->dirty[page] && own_page(chip8, page) == NULL) return;
+		memcpy(&chip8->pages[page][addr % PAGE_SIZE], in, n);
+		in += n;
+		addr += n;
+		len -= n;
+	}
+}
 
-	if (chip8->window == NULL || chip8->renderer == NULL || chip8->texture == NULL){
-		displ_destroy(chip8);
-		return 1;	
-	} 
+void chip8_draw_sprite(chip8_t *chip8, uint8_t X, uint8_t Y, uint8_t N) {
+	int width = chip8_width(chip8);
+	int height = chip8_height(chip8);
+	// the start wraps, pixels past the edge wrap as well
+	int screen_x = chip8->registers[X] % width;
+	int screen_y = chip8->registers[Y] % height;
+	int rows = N ? N : 16;
+	size_t len = N ? N : 32;
+	uint16_t addr = chip8->I;
+	uint8_t sprite[32];
+
+	#ifdef DEBUG
+	printf("Draw on screen: %d(V%d) %d(V%d) height: %d planes: %d\n",
+	screen_x, X, screen_y, Y, N, chip8->planes);
+	#endif
 
-	// apply scale 10 less, so 1 pixel equals 10
-	if (SDL_RenderSetScale(chip8->renderer, 10.0f, 10.0f) < 0) {
-		SDL_DestroyWindow(chip8->window);
-		SDL_DestroyRenderer(chip8->renderer);
+	chip8->registers[VF] = 0;
+	for (int plane = 0; plane < DISPLAY_PLANES; plane++) {
+		if (!(chip8->planes & 1 << plane)) continue;
+		// each plane takes the next sprite in memory
+		chip8_mem_read(chip8, addr, sprite, len);
+		if (chip8->debugger) gdb_stub_watch(chip8->debugger, chip8, addr, len, 0);
+		if (chip8->trace) trace_sprite(chip8->trace, sprite, len);
+		addr += len;
+
+		for (int yc = 0; yc < rows; yc++) {
+			// left aligned in the top word, then rotated into place
+			uint64_t bits = N ? (uint64_t)sprite[yc] << 56 :
+				(uint64_t)(sprite[yc * 2] << 8 | sprite[yc * 2 + 1]) << 48;
+			chip8_row_t row = { .w = { bits, 0 } };
+
+			if (width == DISPLAY_WIDTH) {
+				// rotate the 128 bit row, the second word starts out empty
+				if (screen_x >= 64) row = (chip8_row_t){ .w = { 0, bits } };
+				int s = screen_x % 64;
+				if (s) row = (chip8_row_t){ .w = { row.w[0] >> s | row.w[1] << (64 - s),
+					row.w[1] >> s | row.w[0] << (64 - s) } };
+			}
+			else if (screen_x) row.w[0] = bits >> screen_x | bits << (64 - screen_x);
 
-		fprintf(stderr, "Error setting window scale! %s\n", SDL_GetError());
-		return 1;
+			chip8_row_t *dst = &chip8->screen[plane][(screen_y + yc) % height];
+			// collision
+			if ((dst->w[0] & row.w[0]) | (dst->w[1] & row.w[1])) chip8->registers[VF] = 1;
+			dst->w[0] ^= row.w[0];
+			dst->w[1] ^= row.w[1];
+		}
 	}
+	chip8->draw = 1;
+}
 
-	displ_clear(chip8);
+void chip8_scroll(chip8_t *chip8, int dx, int dy) {
+	int height = chip8_height(chip8);
 
-	// zero out the memory
-	memset(chip8->memory, 0, sizeof(SYS_MEMORY));
-	// copy the fonts into memory
-	memcpy((chip8->memory), fonts, sizeof(fonts));
+	for (int plane = 0; plane < DISPLAY_PLANES; plane++) {
+		if (!(chip8->planes & 1 << plane)) continue;
+		chip8_row_t *rows = chip8->screen[plane];
+
+		if (dy > 0) {
+			memmove(rows + dy, rows, (height - dy) * sizeof(chip8_row_t));
+			memset(rows, 0, dy * sizeof(chip8_row_t));
+		}
+		else if (dy < 0) {
+			memmove(rows, rows - dy, (height + dy) * sizeof(chip8_row_t));
+			memset(rows + height + dy, 0, -dy * sizeof(chip8_row_t));
+		}
+		// at most 4 pixels, carried across from the other word
+		for (int y = 0; y < height && dx > 0; y++) {
+			rows[y].w[1] = rows[y].w[1] >> dx | rows[y].w[0] << (64 - dx);
+			rows[y].w[0] >>= dx;
+		}
+		for (int y = 0; y < height && dx < 0; y++) {
+			rows[y].w[0] = rows[y].w[0] << -dx | rows[y].w[1] >> (64 + dx);
+			rows[y].w[1] <<= -dx;
+		}
+		// lores rows only use the first word
+		for (int y = 0; y < height && !chip8->hires; y++) rows[y].w[1] = 0;
+	}
+	chip8->draw = 1;
+}
+
+int init(chip8_t *chip8, char *rom_path) {
+	if (chip8 == NULL || rom_path == NULL) {
+		return 1;
+	}
+	chip8_reset(chip8);
 
+	if (displ_init(chip8)) return 1;
+	if (chip8_load_rom(chip8, rom_path)) {
+		displ_destroy(chip8);
+		return 1;
+	}
+	return 0;
+}
+
+int chip8_load_rom(chip8_t *chip8, const char *rom_path) {
 	FILE *fp = fopen(rom_path, "rb");
 	if (fp == NULL) {
 		fprintf(stderr, "Error, opening ch8 image (NULL): %s\n", rom_path);
@@ -112,525 +252,297 @@ int init(chip8_t *chip8, char *rom_path) {
 
 	// Get ROM len
 	fseek(fp, 0, SEEK_END);
-	size_t rom_len = ftell(fp);
+	long rom_len = ftell(fp);
 	rewind(fp);
 
-	if ((MEM_END - PC_START) < rom_len) {
+	if (rom_len < 0 || (SYS_MEMORY - PC_START) < rom_len) {
 		fprintf(stderr, "Error, image too large!\n");
 		fclose(fp);
 		return 1;
 	}
-	// Load from 0x200 forward
-	fread(chip8->memory + PC_START, sizeof(uint8_t), rom_len, fp);
-	chip8->stack.size = 0;
+	// read straight into a fresh image, no copy through the stack
+	chip8_image_t *image = chip8_image_create(NULL, 0);
+	if (image == NULL) {
+		fclose(fp);
+		return 1;
+	}
+	if (fread(image->memory + PC_START, 1, rom_len, fp) != (size_t)rom_len) {
+		fprintf(stderr, "Error, reading ch8 image: %s\n", rom_path);
+		chip8_image_release(image);
+		fclose(fp);
+		return 1;
+	}
+	fclose(fp);
+	image->xo = rom_len > CLASSIC_MEMORY - PC_START;
 
-	// put the PC at 0x200
-	chip8->PC = PC_START;
-	store_instr(chip8);
+	// the machine holds the only reference
+	chip8_attach(chip8, image);
+	chip8_image_release(image);
+	return 0;
+}
 
+void chip8_reset(chip8_t *chip8) {
+	if (chip8->image == NULL) chip8->image = &font_image;
+	// drop the written pages, memory is back to the fonts + ROM
+	map_image(chip8);
+
+	memset(chip8->screen, 0, sizeof(chip8->screen));
+	memset(chip8->registers, 0, sizeof(chip8->registers));
+	chip8->stack.size = 0;
+
+	chip8->opcode = 0;
 	chip8->DT = 0;
 	chip8->ST = 0;
 	chip8->I = 0;
+	chip8->SP = 0;
+
+	chip8->keys = 0;
 
-	chip8->key = 0;
+	chip8->planes = 1;
+	memset(chip8->pattern, 0, sizeof(chip8->pattern));
+	chip8->pitch = 64;
 
 	chip8->running = 1;
+	chip8->draw = 0;
+	chip8->paused = 0;
+	chip8->halted = 0;
+	chip8->trapped = 0;
+	chip8->hires = 0;
+	chip8->mem_mask = chip8->xo || chip8->image->xo ? SYS_MEMORY - 1 : CLASSIC_MEMORY - 1;
+	// keeps whatever trace and profile are attached
+	chip8_set_hooks(chip8, chip8->trace, chip8->profile);
+
+	// load the first instruction, the PC always points past the current one
+	chip8->PC = PC_START;
+	fetch(chip8);
+}
 
-	fclose(fp);
-	return 0;
+chip8_image_t *chip8_image_create(const uint8_t *rom, size_t len) {
+	if ((SYS_MEMORY - PC_START) < len) {
+		fprintf(stderr, "Error, image too large!\n");
+		return NULL;
+	}
+	chip8_image_t *image = calloc(1, sizeof(chip8_image_t));
+	if (image == NULL) {
+		fprintf(stderr, "Error allocating ROM image!\n");
+		return NULL;
+	}
+	// copy the fonts into memory
+	memcpy(image->memory, font_image.memory, FONTS_LEN);
+	// Load from 0x200 forward
+	if (len > 0) memcpy(image->memory + PC_START, rom, len);
+	image->xo = len > CLASSIC_MEMORY - PC_START;
+	atomic_init(&image->refs, 1);
+	return image;
+}
 
+void chip8_image_release(chip8_image_t *image) {
+	if (image == NULL || image == &font_image) return;
+	if (atomic_fetch_sub(&image->refs, 1) == 1) free(image);
 }
 
-void fetch(chip8_t *chip8) {	
-	#ifdef DEBUG
-	printf("JMP FLAG: %d ", chip8->jmp_flag);
-	printf("PC = %2x %d\n", chip8->PC, chip8->PC);
-	#endif
+void chip8_attach(chip8_t *chip8, chip8_image_t *image) {
+	if (image != &font_image) atomic_fetch_add(&image->refs, 1);
+	chip8_detach(chip8);
+	chip8->image = image;
+	chip8_reset(chip8);
+}
 
-	store_instr(chip8);
+void chip8_detach(chip8_t *chip8) {
+	chip8_image_t *image = chip8->image;
 
-	if (chip8->jmp_flag == 0 && chip8->paused == 0) {
-		chip8->PC += 2;
-	} 	
+	chip8->image = &font_image;
+	map_image(chip8);
+	chip8_image_release(image);
+}
 
-	chip8->jmp_flag = 0; // set jmp to 0 if jumped
+int chip8_load_image(chip8_t *chip8, const uint8_t *image, size_t len) {
+	chip8_image_t *shared = chip8_image_create(image, len);
+	if (shared == NULL) return 1;
 
-	#ifdef DEBUG
-	printf("STORED NEXT INSTR %04x\n",chip8->opcode);
-	#endif
+	// the machine holds the only reference
+	chip8_attach(chip8, shared);
+	chip8_image_release(shared);
+	return 0;
 }
 
-void decode_and_exec(chip8_t *chip8) {
-	// if not running, free the display and destroy SDL
-	if (!chip8->running) {
-		displ_destroy(chip8);
-		return;
+void chip8_run_frame(chip8_t *chip8, size_t cycles) {
+	for (size_t i = 0; i < cycles && chip8->running; i++) {
+		decode_and_exec(chip8);
+		fetch(chip8);
 	}
-	if (chip8->paused) return;
-
-	uint8_t flag = (chip8->opcode & 0xF000) >> 12;
-	uint8_t X = (chip8->opcode & 0x0F00) >> 8;
-	uint8_t Y = (chip8->opcode & 0x00F0) >> 4;;
-	uint8_t N = chip8->opcode & 0x000F;
-
-	uint8_t NN = chip8->opcode & 0x00FF;
-	uint16_t NNN = chip8->opcode & 0X0FFF;
-
-	#ifdef DEBUG
-	printf("OPCODE: %04x ", chip8->opcode);
-	#endif
+	chip8_tick_timers(chip8);
+}
 
-	// Parse instructions
-	switch (flag) {
-	case 0x0:
-		if (chip8->opcode == 0x00E0) {
-			#ifdef DEBUG
-			printf("Clear screen.\n");
-			#endif
-			displ_clear(chip8);
-		}
+void chip8_tick_timers(chip8_t *chip8) {
+	if (chip8->DT > 0) chip8->DT--;
+	if (chip8->ST > 0) chip8->ST--;
+	if (chip8->trace) trace_frame(chip8->trace, chip8);
+}
 
-		else if (chip8->opcode == 0x00EE) {			
-			#ifdef DEBUG
-			printf("Return to addr %d from stack\n", chip8->stack.array[chip8->stack.size - 1]);
-			#endif
-			pop_stack(chip8);
-			}
+int chip8_save_state(const chip8_t *chip8, chip8_state_t *state) {
+	size_t count = (chip8->mem_mask + 1) / PAGE_SIZE;
 
-		else {			
-			#ifdef DEBUG
-			printf("Call machine code to %d.\n", NNN);
-			#endif
-			// store address on the stack 
-			push_stack(chip8);
-			chip8->PC = NNN;
-			chip8->jmp_flag = 1;
+	// 4 KB for CHIP-8, 64 KB only in XO-CHIP mode
+	if (state->page_count != count) {
+		uint8_t (*pages)[PAGE_SIZE] = realloc(state->pages, count * PAGE_SIZE);
+		if (pages == NULL) {
+			fprintf(stderr, "Error allocating a snapshot!\n");
+			return 1;
 		}
-		break;
-	case 0x1: {
-		#ifdef DEBUG
-		printf("JMP to %d. ", NNN);
-		#endif
-		
-		validate_NNN(chip8, NNN);
-
-		chip8->jmp_flag = 1;
-		chip8->PC = NNN;
-		break;
+		state->pages = pages;
+		state->page_count = count;
 	}
-	case 0x2: {
-		validate_NNN(chip8, NNN);
-
-		#ifdef DEBUG
-		printf("Call subroutine at: %d\n", NNN);
-		#endif
-
-		push_stack(chip8);
-		chip8->PC = NNN;
-		chip8->jmp_flag = 1;
-		break;	
+	// pages still shared with the image are the same for every machine
+	for (size_t i = 0; i < count; i++) {
+		state->dirty[i] = chip8->dirty[i];
+		if (chip8->dirty[i]) memcpy(state->pages[i], chip8->pages[i], PAGE_SIZE);
 	}
-	case 0x3: {
-		validate_X(chip8, X);
-
-		#ifdef DEBUG
-		printf("Compare: %d == %d (NN) ", 
-			chip8->registers[X], NN);
-		if (chip8->registers[X] == NN) printf("Skipped\n");
-		else printf("\n");
-		#endif
-		// Skips the next instruction if VX equals NN
-		if (chip8->registers[X] == NN) {
-			chip8->PC += 2;
-		}
-		break;
-		}
-	case 0x4: {
-		validate_X(chip8, X);
-
-		#ifdef DEBUG
-		printf("Compare NOT: %d != %d(NN) ", 
-			chip8->registers[X], NN);
-		if (chip8->registers[X] != NN) printf("Skipped\n");
-		else printf("\n");
-		#endif
-
-		// Skip next instruction if NN != Vx
-		if (chip8->registers[X] != NN) {
-			chip8->PC += 2;
-		}  
-		break;
-		}
-	case 0x5: {
-		validate_XY(chip8, X, Y);
-
-		#ifdef DEBUG
-		printf("Compare: %d == %d(Y) ", 
-			chip8->registers[X], chip8->registers[Y]);
-		if (chip8->registers[X] == chip8->registers[Y]) printf("Skipped\n");
-		else printf("\n");
-		#endif
-
-		if (chip8->registers[X] == chip8->registers[Y]) {
-			chip8->PC += 2;
-		}
+	memcpy(state->screen, chip8->screen, sizeof(state->screen));
+	state->planes = chip8->planes;
+	memcpy(state->pattern, chip8->pattern, sizeof(state->pattern));
+	state->pitch = chip8->pitch;
+	memcpy(state->registers, chip8->registers, sizeof(state->registers));
+	state->stack = chip8->stack;
+
+	state->opcode = chip8->opcode;
+	state->PC = chip8->PC;
+	state->I = chip8->I;
+	state->DT = chip8->DT;
+	state->ST = chip8->ST;
+	state->keys = chip8->keys;
+	state->running = chip8->running;
+	state->halted = chip8->halted;
+	state->hires = chip8->hires;
+	return 0;
+}
 
-		break;
-		}
-	case 0x6: {
-		validate_X(chip8, X);
-		chip8->registers[X] = NN;\
-
-		#ifdef DEBUG
-		printf("V%d set to %d\n", 
-			X, chip8->registers[X]);
-		#endif
-		
-		break;
+int chip8_load_state(chip8_t *chip8, const chip8_state_t *state) {
+	uint8_t *fresh[PAGE_COUNT] = {0};
+
+	// allocate every page first, a failure leaves the machine as it was
+	for (size_t i = 0; i < state->page_count; i++) {
+		if (!state->dirty[i] || chip8->dirty[i]) continue;
+		fresh[i] = malloc(PAGE_SIZE);
+		if (fresh[i] == NULL) {
+			fprintf(stderr, "Error allocating memory page %zu!\n", i);
+			for (size_t j = 0; j < i; j++) free(fresh[j]);
+			return 1;
 		}
-	case 0x7: {
-		validate_X(chip8, X);
-
-		#ifdef DEBUG
-		printf("Add %d to V%d = %d\n", 
-			NN, X, chip8->registers[X]);
-		#endif
-		chip8->registers[X] += NN; 
-		break;
-		}
-	case 0x8: {
-		validate_XY(chip8, X, Y);
-
-		switch (N) {
-			case 0x0:
-				chip8->registers[X] = chip8->registers[Y];
-				#ifdef DEBUG
-				printf("Set V%d to V%d = %d\n", 
-				X, Y, chip8->registers[X]);
-				#endif
-				break;
-			case 0x1:
-				chip8->registers[X] |= chip8->registers[Y];
-				#ifdef DEBUG
-				printf("bitwise OR V%d to V%d = %d\n", 
-				X, Y, chip8->registers[X]);
-				#endif
-				break;
-			case 0x2:
-				chip8->registers[X] &= chip8->registers[Y];
-				#ifdef DEBUG
-				printf("bitwise AND V%d to V%d = %d\n", 
-				X, Y, chip8->registers[X]);
-				#endif
-				break;
-			case 0x3:
-				chip8->registers[X] ^= chip8->registers[Y];
-				#ifdef DEBUG
-				printf("bitwise XOR V%d to V%d = %d\n", 
-				X, Y, chip8->registers[X]);
-				#endif
-				break;
-			case 0x4: {
-				uint16_t res = chip8->registers[X] + chip8->registers[Y];
-				// max value of a uint8_t 255
-				// check for overflow first
-				if (res > UINT8_MAX) {
-					#ifdef DEBUG
-					printf("overflow detected:  ");
-					#endif		
-					chip8->registers[VF] = 1;
-				}
-				else chip8->registers[VF] = 0;
-				
-				chip8->registers[X] += chip8->registers[Y];
-				
-				#ifdef DEBUG
-				printf("Add V%d to V%d(X) = %d\n", 
-				Y, X, chip8->registers[X]);
-				#endif
-				break;
-				}
-			case 0x5: {
-				// signed to check for underflow
-				int res = chip8->registers[X] - chip8->registers[Y];
-				// max value of a uint8_t 255
-				// check for overflow first
-				if (res < 0) {
-					#ifdef DEBUG
-					printf("underflow detected: ");
-					#endif		
-					chip8->registers[VF] = 0;
-				}
-				else chip8->registers[VF] = 1;
-				
-				chip8->registers[X] -= chip8->registers[Y];
-				
-				#ifdef DEBUG
-				printf("substract V%d from V%d(X) = %d\n", 
-				Y, X, chip8->registers[X]);
-				#endif
-				break;
-			}
-			case 0x6: {
-				// store least significant bit in VF
-				chip8->registers[VF] = chip8->registers[X] & 0x1;
-				chip8->registers[X] >>= 1;
-
-				#ifdef DEBUG
-				printf("Shift V%d >> 1 = %d\n",
-					X, chip8->registers[X]);
-				#endif
-				break;
-			}
-			case 0x7: {
-				int res = chip8->registers[Y] - chip8->registers[X];
-				if (res < 0) {
-					#ifdef DEBUG
-					printf("underflow detected: ");
-					#endif
-					chip8->registers[VF] = 0;
-				}
-				else chip8->registers[VF] = 1;
-				chip8->registers[X] = chip8->registers[Y] - chip8->registers[X];
-				#ifdef DEBUG
-				printf("substract V%d(Y) - V%d = %d\n",
-					Y, X, chip8->registers[X]);
-				#endif
-				break;
-			}
-			case 0x0E: {
-				// store most significant
-				chip8->registers[VF] = chip8->registers[X] & (0x01 << 7);
-				chip8->registers[X] <<= 1;
-				#ifdef DEBUG
-				printf("Shift V%d << 1 = %d\n",
-					X, chip8->registers[X]);
-				#endif
-				break;
+	}
+	for (size_t i = 0; i < state->page_count; i++) {
+		if (state->dirty[i]) {
+			if (fresh[i] != NULL) {
+				chip8->pages[i] = fresh[i];
+				chip8->dirty[i] = 1;
 			}
+			memcpy(chip8->pages[i], state->pages[i], PAGE_SIZE);
 		}
-		break;
+		else if (chip8->dirty[i]) {
+			free(chip8->pages[i]);
+			chip8->dirty[i] = 0;
+			chip8->pages[i] = chip8->image->memory + i * PAGE_SIZE;
 		}
+	}
+	memcpy(chip8->screen, state->screen, sizeof(chip8->screen));
+	chip8->planes = state->planes;
+	memcpy(chip8->pattern, state->pattern, sizeof(chip8->pattern));
+	chip8->pitch = state->pitch;
+	memcpy(chip8->registers, state->registers, sizeof(chip8->registers));
+	chip8->stack = state->stack;
+
+	chip8->opcode = state->opcode;
+	chip8->PC = state->PC;
+	chip8->I = state->I;
+	chip8->DT = state->DT;
+	chip8->ST = state->ST;
+	chip8->keys = state->keys;
+	chip8->running = state->running;
+	chip8->halted = state->halted;
+	chip8->hires = state->hires;
+	chip8->draw = 1;
+	return 0;
+}
 
-	case 0x9: {
-		validate_XY(chip8, X, Y);
-		
-		#ifdef DEBUG
-		printf("Skip next V%d != V%d\n",
-			X, Y);
-		#endif
+static uint32_t fnv1a(uint32_t hash, const void *data, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		hash = (hash ^ ((const uint8_t *)data)[i]) * 16777619u;
+	}
+	return hash;
+}
 
-		if (chip8->registers[X] != chip8->registers[Y]) {
-			chip8->PC +=2;
-		}
-		break;	
-		}
-	case 0xA: {
-		validate_NNN(chip8, NNN);
-
-		chip8->I = NNN;
-		#ifdef DEBUG
-		printf("Set I to %d\n",
-			chip8->I);
-		#endif
-		break;
-		}
-	case 0xB: {
-		validate_NNN(chip8, NNN);
-
-		#ifdef DEBUG
-		printf("JMP to (V0) %d + %d = %d\n",
-			chip8->registers[V0], NNN, NNN + chip8->registers[V0]);
-		#endif
-		
-		chip8->PC = chip8->registers[V0] + NNN;
-		chip8->jmp_flag = 1;
-		break;
-		}
-	case 0xD: {
-		validate_XY(chip8, X, Y);
-		// TODO draw
-		// reset the register
-		chip8->registers[VF] = 0;
-
-		uint8_t screen_x = chip8->registers[X];
-		uint8_t screen_y = chip8->registers[Y];
-		#ifdef DEBUG
-		printf("Draw on screen: %d(V%d) %d(V%d) height: %d\n",
-		screen_x, X, screen_y, Y, N);
-		#endif
-
-		for (uint8_t yc = 0; yc < N; yc++) {
-			// reverse the byte order
-			uint8_t sprite_byte = 
-				chip8->memory[chip8->I + yc];
-			for (uint8_t xc = 0; xc < 8; xc++) {
-				printf("%d ", (sprite_byte >> (7 - xc)) & 0x1);
-				if ((sprite_byte >> (7 - xc)) & 0x1) {
-					// loop around if bigger 
-					uint8_t x = (screen_x + xc) % DISPLAY_WIDTH;
-					uint8_t y = (screen_y + yc) % DISPLAY_HEIGHT;
-					// collision
-					if (chip8->screen[x][y]) chip8->registers[VF] = 1;
-					// XOR the pixel
-					chip8->screen[x][y] ^= 1;
-				}
-			}
-			printf("\n");
-		}
+uint32_t chip8_state_hash(const chip8_state_t *state) {
+	uint32_t hash = 2166136261u;
 
-		chip8->draw = 1;
-		break;
-		}
-	case 0xE: {
-		validate_X(chip8, X);
+	for (size_t i = 0; i < state->page_count; i++) {
+		hash = fnv1a(hash, &state->dirty[i], 1);
+		if (state->dirty[i]) hash = fnv1a(hash, state->pages[i], PAGE_SIZE);
+	}
+	hash = fnv1a(hash, state->screen, sizeof(state->screen));
+	hash = fnv1a(hash, &state->planes, 1);
+	hash = fnv1a(hash, state->pattern, sizeof(state->pattern));
+	hash = fnv1a(hash, &state->pitch, 1);
+	hash = fnv1a(hash, &state->hires, 1);
+	hash = fnv1a(hash, state->registers, sizeof(state->registers));
+	hash = fnv1a(hash, state->stack.array, state->stack.size * sizeof(uint16_t));
+	hash = fnv1a(hash, &state->PC, sizeof(state->PC));
+	hash = fnv1a(hash, &state->I, sizeof(state->I));
+	hash = fnv1a(hash, &state->DT, 1);
+	return fnv1a(hash, &state->ST, 1);
+}
 
-		if (NN == 0x9E) {
-			#ifdef DEBUG
-				printf("Skip on key %d\n", chip8->registers[X]);
-			#endif
+void chip8_state_free(chip8_state_t *state) {
+	free(state->pages);
+	state->pages = NULL;
+	state->page_count = 0;
+}
 
-			if (chip8->key == chip8->registers[X]) {
-				chip8->PC += 2;
-			}
-		}	
-		else if (NN == 0xA1) {
-			#ifdef DEBUG
-			printf("Skip NOT on key %d\n", chip8->registers[X]);
-			#endif
-
-			if (chip8->key != chip8->registers[X]) {
-				chip8->PC += 2;
-			}
-		else {
-			fprintf(stderr, "ERROR: ILLEGAL OPCODE in 0xE0: %04x\n", chip8->opcode);
-			chip8->running = 0;
-			return;
-			}
-		}
-		break;
-		}
-	case 0xF: {
-		switch (NN) {
-		case 0x07:
-			#ifdef DEBUG
-			printf("Set V%d to timer %d\n", X, chip8->DT);
-			#endif
-			chip8->registers[X] = chip8->DT;
-			break;
-		case 0x0A:
-			// TODO ST and DT should continue
-			// A halt flag should be implemented?
-			#ifdef DEBUG
-			printf("Await input to set V%d to\n", X);
-			#endif
-
-			while (chip8->key == 0) {
-				handle_input(chip8);
-			}
+void fetch(chip8_t *chip8) {	
+	#ifdef DEBUG
+	printf("PC = %2x %d\n", chip8->PC, chip8->PC);
+	#endif
 
-			chip8->registers[X] = chip8->key;
-			break;
-		case 0x15:
-			#ifdef DEBUG
-			printf("Set DT to %d\n", chip8->registers[X]);
-			#endif
-			chip8->DT = chip8->registers[X];
-			break;
-		case 0x18:
-			#ifdef DEBUG
-			printf("Set ST to %d\n", chip8->registers[X]);
-			#endif
-			chip8->ST = chip8->registers[X];
-			break;
-		case 0x1E:
-			#ifdef DEBUG
-			printf("Add %d to I = %d\n", chip8->registers[X], chip8->I + chip8->registers[X]);
-			#endif
-			chip8->I += chip8->registers[X];
-			break;
-		case 0x29:
-			#ifdef DEBUG
-			printf("Set I sprite addr: %d\n", chip8->registers[X]);
-			#endif
-			chip8->I = chip8->registers[X] * 0x5;
-			break;
-		case 0x33:
-			#ifdef DEBUG
-			printf("set BCD OP\n");
-			#endif
-			chip8->memory[chip8->I] = chip8->registers[X] / 100;
-			chip8->memory[chip8->I + 1] = (chip8->registers[X] / 10) % 10;
-			chip8->memory[chip8->I + 2] = (chip8->registers[X] % 100) % 10;
-			break;
-		case 0x55: {
-			validate_X(chip8, X);
-			#ifdef DEBUG
-			printf("Store from V0 to V%d registers\n", X);
-			#endif
-			size_t i = 0;
-			while (i <= X) {
-				chip8->memory[chip8->I + i] = chip8->registers[i];
-				i++;
-			}
-			break;
-		}
-		case 0x65: {
-			validate_X(chip8, X);
-			#ifdef DEBUG
-			printf("Store from V0 to V%d in memory\n", X);
-			#endif
-			size_t i = 0;
-			while (i <= X) {
-				chip8->registers[i] = chip8->memory[chip8->I + i];
-				i++;
-			}
-			break;
-		}
-		default:
-			fprintf(stderr, "ERROR: ILLEGAL OPCODE in 0xF0: %04x\n", chip8->opcode);
-			chip8->running = 0;
-			return;
-		}
-		break;
-	}
+	// FX0A is executed again until a key arrives
+	if (chip8->halted || chip8->paused) return;
 
-	default:
-		fprintf(stderr, "ERROR: UNKNOWN OPCODE: %04x\n", chip8->opcode);
-		chip8->running = 0;
-		return;
-	}
-	// check if screen needs to be updated
-	if (chip8->draw == 1) {
-		displ_present(chip8);
-		chip8->draw = 0;
-	}
+	// wrap around the end of memory instead of checking for it
+	chip8->PC &= chip8->mem_mask;
+	store_instr(chip8);
+	chip8->PC += 2;
 
-	if (chip8->PC+2 == MEM_END) {
-		fprintf(stderr, "ERROR: PC Reached MEM_END\n");
-		// temp
-		chip8->paused = 1;
-	}
+	#ifdef DEBUG
+	printf("STORED NEXT INSTR %04x\n",chip8->opcode);
+	#endif
 }
 
-static void validate_NNN(chip8_t *chip8, uint16_t NNN) {
-	if (NNN > 0xFFF) {
-		fprintf(stderr, "Attempted to reach address outside RAM! %d\n", NNN);
-		chip8->running = 0;
+void decode_and_exec(chip8_t *chip8) {
+	if (chip8->trapped || !chip8->running || chip8->paused) {
+		// the debugger asked to stop, serve it before running this instruction
+		if (chip8->trapped) gdb_stub_stop(chip8->debugger, chip8);
+		if (!chip8->running || chip8->paused) return;
 	}
+
+	chip8->exec(chip8);
 }
 
-static void validate_X(chip8_t *chip8, uint8_t X) {
-	if (X > VF) {
-		fprintf(stderr, "ERROR: Tried to access non-existant register: %d", X);
-		chip8->running = 0;
-	}
+// the only copy of the switch in the interpreter
+static __attribute__((noinline)) void exec_plain(chip8_t *chip8) {
+	chip8_exec(chip8, chip8->opcode);
 }
 
-static void validate_XY(chip8_t *chip8, uint8_t X, uint8_t Y) {
-	if (X > VF || Y > VF) {
-		fprintf(stderr, "ERROR: Tried to access non-existant register: %d(X) %d(Y)", X, Y);
-		chip8->running = 0;
-	}
+static void exec_hooked(chip8_t *chip8) {
+	// the PC already points past the instruction
+	uint16_t addr = chip8->PC - 2;
+	size_t depth = chip8->stack.size;
+
+	exec_plain(chip8);
+	// read after, a breakpoint's trap swaps in the instruction it replaced
+	if (chip8->trace) trace_exec(chip8->trace, chip8, addr, chip8->opcode);
+	if (chip8->profile) profile_exec(chip8->profile, chip8, addr, depth);
 }
 
+void chip8_set_hooks(chip8_t *chip8, struct trace *trace, struct profile *profile) {
+	chip8->trace = trace;
+	chip8->profile = profile;
+	chip8->exec = trace == NULL && profile == NULL ? exec_plain : exec_hooked;
+}
@@ -0,0 +1,85 @@
+#include <stdio.h>
+
+#include "../include/disasm.h"
+
+static const char *alu[16] = {
+	"LD", "OR", "AND", "XOR", "ADD", "SUB", "SHR", "SUBN",
+	NULL, NULL, NULL, NULL, NULL, NULL, "SHL", NULL
+};
+
+int disasm(uint16_t op, uint16_t next, char *out, size_t len) {
+	uint8_t X = (op & 0x0F00) >> 8;
+	uint8_t Y = (op & 0x00F0) >> 4;
+	uint8_t N = op & 0x000F;
+	uint8_t NN = op & 0x00FF;
+	uint16_t NNN = op & 0x0FFF;
+
+	switch (op >> 12) {
+	case 0x0:
+		if (op == 0x00E0) snprintf(out, len, "CLS");
+		else if (op == 0x00EE) snprintf(out, len, "RET");
+		else if ((op & 0xFFF0) == 0x00C0) snprintf(out, len, "SCD %d", N);
+		else if ((op & 0xFFF0) == 0x00D0) snprintf(out, len, "SCU %d", N);
+		else if (op == 0x00FB) snprintf(out, len, "SCR");
+		else if (op == 0x00FC) snprintf(out, len, "SCL");
+		else if (op == 0x00FD) snprintf(out, len, "EXIT");
+		else if (op == 0x00FE) snprintf(out, len, "LOW");
+		else if (op == 0x00FF) snprintf(out, len, "HIGH");
+		// run as a call by the core
+		else snprintf(out, len, "SYS 0x%03x", NNN);
+		break;
+	case 0x1: snprintf(out, len, "JP 0x%03x", NNN); break;
+	case 0x2: snprintf(out, len, "CALL 0x%03x", NNN); break;
+	case 0x3: snprintf(out, len, "SE V%X, 0x%02x", X, NN); break;
+	case 0x4: snprintf(out, len, "SNE V%X, 0x%02x", X, NN); break;
+	case 0x5:
+		if (N == 0x0) snprintf(out, len, "SE V%X, V%X", X, Y);
+		else if (N == 0x2) snprintf(out, len, "SAVE V%X-V%X", X, Y);
+		else if (N == 0x3) snprintf(out, len, "LOAD V%X-V%X", X, Y);
+		else snprintf(out, len, "DW 0x%04x", op);
+		break;
+	case 0x6: snprintf(out, len, "LD V%X, 0x%02x", X, NN); break;
+	case 0x7: snprintf(out, len, "ADD V%X, 0x%02x", X, NN); break;
+	case 0x8:
+		if (alu[N] == NULL) snprintf(out, len, "DW 0x%04x", op);
+		else if (N == 0x6 || N == 0xE) snprintf(out, len, "%s V%X", alu[N], X);
+		else snprintf(out, len, "%s V%X, V%X", alu[N], X, Y);
+		break;
+	case 0x9: snprintf(out, len, "SNE V%X, V%X", X, Y); break;
+	case 0xA: snprintf(out, len, "LD I, 0x%03x", NNN); break;
+	case 0xB: snprintf(out, len, "JP V0, 0x%03x", NNN); break;
+	case 0xC: snprintf(out, len, "RND V%X, 0x%02x", X, NN); break;
+	case 0xD: snprintf(out, len, "DRW V%X, V%X, %d", X, Y, N); break;
+	case 0xE:
+		if (NN == 0x9E) snprintf(out, len, "SKP V%X", X);
+		else if (NN == 0xA1) snprintf(out, len, "SKNP V%X", X);
+		else snprintf(out, len, "DW 0x%04x", op);
+		break;
+	case 0xF:
+		switch (NN) {
+		case 0x00:
+			if (X != 0) break;
+			snprintf(out, len, "LD I, 0x%04x", next);
+			return 4;
+		case 0x01: snprintf(out, len, "PLANE %d", X); return 2;
+		case 0x02:
+			if (X != 0) break;
+			snprintf(out, len, "AUDIO");
+			return 2;
+		case 0x07: snprintf(out, len, "LD V%X, DT", X); return 2;
+		case 0x0A: snprintf(out, len, "LD V%X, K", X); return 2;
+		case 0x15: snprintf(out, len, "LD DT, V%X", X); return 2;
+		case 0x18: snprintf(out, len, "LD ST, V%X", X); return 2;
+		case 0x1E: snprintf(out, len, "ADD I, V%X", X); return 2;
+		case 0x29: snprintf(out, len, "LD F, V%X", X); return 2;
+		case 0x30: snprintf(out, len, "LD HF, V%X", X); return 2;
+		case 0x33: snprintf(out, len, "LD B, V%X", X); return 2;
+		case 0x3A: snprintf(out, len, "PITCH V%X", X); return 2;
+		case 0x55: snprintf(out, len, "LD [I], V%X", X); return 2;
+		case 0x65: snprintf(out, len, "LD V%X, [I]", X); return 2;
+		}
+		snprintf(out, len, "DW 0x%04x", op);
+		break;
+	}
+	return 2;
+}
@@ -1,10 +1,18 @@
+#include <string.h>
+
 #include "SDL2/SDL.h"
 
 #include "../include/display.h"
 #include "../include/chip8.h"
+#include "../include/latency.h"
+
+#define WINDOW_WIDTH 	DISPLAY_WIDTH * 5 		// 128 * 5
+#define WINDOW_HEIGHT 	DISPLAY_HEIGHT * 5 	// 64 * 5
 
-#define WINDOW_WIDTH 	DISPLAY_WIDTH * 10 		// 64 * 10
-#define WINDOW_HEIGHT 	DISPLAY_HEIGHT * 10 	// 32 * 10
+// RGBA by pixel colour, off, plane 1, plane 2, both
+static const uint32_t palette[1 << DISPLAY_PLANES] = {
+	0x000000FF, 0xFFFFFFFF, 0xAAAAAAFF, 0x555555FF
+};
 
 int displ_init_SDL() {
 	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO)) {
@@ -35,7 +43,7 @@ SDL_Renderer *displ_init_Renderer(SDL_Window *window) {
 
 SDL_Texture *displ_init_Texture(SDL_Renderer *renderer) {
 	if (renderer == NULL) return NULL;
-	// TODO High-res mode, need to remove the macro and do runtime checks
+	// always hires, lores pixels are drawn 2x2
 	SDL_Texture *texture = SDL_CreateTexture(renderer, 
 		SDL_PIXELFORMAT_RGBA8888,
 		SDL_TEXTUREACCESS_TARGET,
@@ -48,13 +56,31 @@ SDL_Texture *displ_init_Texture(SDL_Renderer *renderer) {
 	return texture;
 }
 
+int displ_init(chip8_t *chip8) {
+	if (displ_init_SDL()) return 1;
+	chip8->window = displ_init_Window();
+	chip8->renderer = displ_init_Renderer(chip8->window);
+	chip8->texture = displ_init_Texture(chip8->renderer);
+
+	if (chip8->window == NULL || chip8->renderer == NULL || chip8->texture == NULL) {
+		displ_destroy(chip8);
+		return 1;
+	}
+
+	// apply scale 5 less, so 1 hires pixel equals 5
+	if (SDL_RenderSetScale(chip8->renderer, 5.0f, 5.0f) < 0) {
+		fprintf(stderr, "Error setting window scale! %s\n", SDL_GetError());
+		displ_destroy(chip8);
+		return 1;
+	}
+
+	displ_clear(chip8);
+	return 0;
+}
+
 void displ_clear(chip8_t *chip8) {
 	// clear all screen bits
-	for (int x = 0; x < DISPLAY_WIDTH; x++) {
-		for (int y = 0; y < DISPLAY_HEIGHT; y++) {
-			chip8->screen[x][y] = 0;
-		}
-	}
+	memset(chip8->screen, 0, sizeof(chip8->screen));
 	// set to black
 	SDL_SetRenderDrawColor(chip8->renderer, 0, 0, 0, 255);
 	SDL_RenderClear(chip8->renderer);
@@ -62,27 +88,30 @@ void displ_clear(chip8_t *chip8) {
 }
 
 void displ_present(chip8_t *chip8) {
-	uint32_t screen_buffer[DISPLAY_WIDTH * DISPLAY_HEIGHT] = {0};
-	uint32_t pxl;
-
-	for (uint8_t x = 0; x < DISPLAY_WIDTH; x++) {
-		for (uint8_t y = 0; y < DISPLAY_HEIGHT; y++)
-		{
-			pxl = chip8->screen[x][y] * 0xFFFFFF00;
-			// set alpha to 0xFF regardless if it's 0 or 1
-			pxl |= 0x000000FF;
-       	 	screen_buffer[y * DISPLAY_WIDTH + x] = pxl;
+	uint32_t screen_buffer[DISPLAY_WIDTH * DISPLAY_HEIGHT];
+	// 2 in lores
+	int scale = DISPLAY_WIDTH / chip8_width(chip8);
+
+	for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+		for (int x = 0; x < DISPLAY_WIDTH; x++) {
+       	 	screen_buffer[y * DISPLAY_WIDTH + x] = palette[chip8_pixel(chip8, x / scale, y / scale)];
 		}
 	}
 	SDL_UpdateTexture(chip8->texture, NULL, screen_buffer, DISPLAY_WIDTH * sizeof(uint32_t));
 	SDL_RenderClear(chip8->renderer);
     SDL_RenderCopy(chip8->renderer, chip8->texture, NULL, NULL );
 	SDL_RenderPresent(chip8->renderer);
+
+	if (chip8->latency) latency_present(chip8->latency, chip8);
 }
 
 void displ_destroy(chip8_t *chip8) {
+	// children first, the texture belongs to the renderer and the renderer to the window
 	if (chip8->texture != NULL) SDL_DestroyTexture(chip8->texture);
 	if (chip8->renderer != NULL) SDL_DestroyRenderer(chip8->renderer);
 	if (chip8->window != NULL) SDL_DestroyWindow(chip8->window);
+	chip8->texture = NULL;
+	chip8->renderer = NULL;
+	chip8->window = NULL;
 	SDL_Quit();
 }
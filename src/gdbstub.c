@@ -0,0 +1,650 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "../include/gdbstub.h"
+
+#define PACKET_MAX 1024
+// 16 V registers, I, PC, SP, DT, ST
+#define REG_BYTES 23
+#define REG_COUNT 21
+
+#define SIG_INT  2
+#define SIG_TRAP 5
+
+static const char hex[] = "0123456789abcdef";
+
+// register layout for the client, there is no CHIP-8 architecture in gdb to take it from
+static const char target_xml[] =
+	"<?xml version=\"1.0\"?>\n"
+	"<!DOCTYPE target SYSTEM \"gdb-target.dtd\">\n"
+	"<target version=\"1.0\">\n"
+	"<feature name=\"org.chip8.core\">\n"
+	"  <reg name=\"v0\" bitsize=\"8\" type=\"uint8\"/>\n"
+	"  <reg name=\"v1\" bitsize=\"8\" type=\"uint8\"/>\n"
+	"  <reg name=\"v2\" bitsize=\"8\" type=\"uint8\"/>\n"
+	"  <reg name=\"v3\" bitsize=\"8\" type=\"uint8\"/>\n"
+	"  <reg name=\"v4\" bitsize=\"8\" type=\"uint8\"/>\n"
+	"  <reg name=\"v5\" bitsize=\"8\" type=\"uint8\"/>\n"
+	"  <reg name=\"v6\" bitsize=\"8\" type=\"uint8\"/>\n"
+	"  <reg name=\"v7\" bitsize=\"8\" type=\"uint8\"/>\n"
+	"  <reg name=\"v8\" bitsize=\"8\" type=\"uint8\"/>\n"
+	"  <reg name=\"v9\" bitsize=\"8\" type=\"uint8\"/>\n"
+	"  <reg name=\"va\" bitsize=\"8\" type=\"uint8\"/>\n"
+	"  <reg name=\"vb\" bitsize=\"8\" type=\"uint8\"/>\n"
+	"  <reg name=\"vc\" bitsize=\"8\" type=\"uint8\"/>\n"
+	"  <reg name=\"vd\" bitsize=\"8\" type=\"uint8\"/>\n"
+	"  <reg name=\"ve\" bitsize=\"8\" type=\"uint8\"/>\n"
+	"  <reg name=\"vf\" bitsize=\"8\" type=\"uint8\"/>\n"
+	"  <reg name=\"i\" bitsize=\"16\" type=\"data_ptr\"/>\n"
+	"  <reg name=\"pc\" bitsize=\"16\" type=\"code_ptr\"/>\n"
+	"  <reg name=\"sp\" bitsize=\"8\" type=\"uint8\"/>\n"
+	"  <reg name=\"dt\" bitsize=\"8\" type=\"uint8\"/>\n"
+	"  <reg name=\"st\" bitsize=\"8\" type=\"uint8\"/>\n"
+	"</feature>\n"
+	"</target>\n";
+
+// blocking packet io on the client socket, returns -1 when the client is gone
+static int read_char(gdb_stub_t *stub);
+static int read_packet(gdb_stub_t *stub, char *buf, size_t max);
+static void send_packet(gdb_stub_t *stub, const char *data);
+static void send_stop(gdb_stub_t *stub);
+
+// process packets until the client resumes or detaches
+static void serve(gdb_stub_t *stub, chip8_t *chip8);
+// reload the current instruction with the breakpoints hidden and clear the stop
+static void resume(gdb_stub_t *stub, chip8_t *chip8);
+static void step(gdb_stub_t *stub, chip8_t *chip8);
+
+// memory as the program sees it, breakpoints hidden
+static uint8_t peek(gdb_stub_t *stub, chip8_t *chip8, uint16_t addr);
+static void poke(gdb_stub_t *stub, chip8_t *chip8, uint16_t addr, uint8_t val);
+
+static void read_registers(chip8_t *chip8, uint8_t *regs);
+static void write_registers(chip8_t *chip8, const uint8_t *regs);
+// byte offset and size of a register in the 'g' packet, returns 0 if unknown
+static size_t reg_layout(size_t n, size_t *offset);
+
+static void handle_point(gdb_stub_t *stub, chip8_t *chip8, char *buf);
+// qXfer:features:read:target.xml:offset,length
+static void read_features(gdb_stub_t *stub, const char *annex);
+static int insert_breakpoint(gdb_stub_t *stub, chip8_t *chip8, uint16_t addr);
+static int remove_breakpoint(gdb_stub_t *stub, chip8_t *chip8, uint16_t addr);
+
+static int from_hex(int c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+static void to_hex(char *out, const uint8_t *data, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		out[i * 2] = hex[data[i] >> 4];
+		out[i * 2 + 1] = hex[data[i] & 0xF];
+	}
+	out[len * 2] = '\0';
+}
+
+// returns the number of bytes decoded
+static size_t parse_hex(uint8_t *out, const char *in, size_t max) {
+	size_t len = 0;
+	while (len < max && from_hex(in[0]) >= 0 && from_hex(in[1]) >= 0) {
+		out[len++] = from_hex(in[0]) << 4 | from_hex(in[1]);
+		in += 2;
+	}
+	return len;
+}
+
+int gdb_stub_open(gdb_stub_t *stub, const char *addr) {
+	memset(stub, 0, sizeof(gdb_stub_t));
+	stub->client_fd = -1;
+
+	char *end;
+	long port = strtol(addr, &end, 10);
+
+	if (*end == '\0' && port > 0 && port < 65536) {
+		struct sockaddr_in in = {0};
+		int one = 1;
+
+		in.sin_family = AF_INET;
+		in.sin_port = htons(port);
+		// never expose the stub outside the box
+		in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		stub->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (stub->listen_fd < 0) goto error;
+		setsockopt(stub->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (bind(stub->listen_fd, (struct sockaddr *)&in, sizeof(in)) < 0) goto error;
+	}
+	else {
+		struct sockaddr_un un = {0};
+
+		if (strlen(addr) >= sizeof(un.sun_path)) {
+			fprintf(stderr, "Error, gdb socket path too long: %s\n", addr);
+			return 1;
+		}
+		un.sun_family = AF_UNIX;
+		strcpy(un.sun_path, addr);
+		strcpy(stub->path, addr);
+		unlink(addr);
+
+		stub->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (stub->listen_fd < 0) goto error;
+		if (bind(stub->listen_fd, (struct sockaddr *)&un, sizeof(un)) < 0) goto error;
+	}
+
+	if (listen(stub->listen_fd, 1) < 0) goto error;
+	// accept() is polled from the main loop
+	fcntl(stub->listen_fd, F_SETFL, O_NONBLOCK);
+	printf("gdb stub listening on %s\n", addr);
+	return 0;
+
+error:
+	perror("Error opening gdb stub");
+	if (stub->listen_fd >= 0) close(stub->listen_fd);
+	stub->listen_fd = -1;
+	return 1;
+}
+
+void gdb_stub_poll(gdb_stub_t *stub, chip8_t *chip8) {
+	if (stub->listen_fd < 0) return;
+
+	if (stub->client_fd < 0) {
+		int fd = accept(stub->listen_fd, NULL, NULL);
+		if (fd < 0) return;
+
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		fcntl(fd, F_SETFL, 0);
+
+		printf("gdb attached\n");
+		stub->client_fd = fd;
+		stub->signal = SIG_TRAP;
+		stub->resumed = 0;
+		// stop before the next instruction, gdb expects a halted target
+		chip8->debugger = stub;
+		chip8->trapped = 1;
+		return;
+	}
+
+	// look for a ctrl-c, anything else while running is a stray ack
+	char c;
+	ssize_t n;
+	while ((n = recv(stub->client_fd, &c, 1, MSG_DONTWAIT)) == 1) {
+		if (c == 0x03) {
+			stub->signal = SIG_INT;
+			chip8->trapped = 1;
+			return;
+		}
+	}
+	if (n == 0) gdb_stub_detach(stub, chip8);
+}
+
+uint16_t gdb_stub_trap(gdb_stub_t *stub, chip8_t *chip8) {
+	uint16_t addr = chip8->PC - 2;
+	size_t i;
+
+	for (i = 0; i < stub->bp_count; i++) {
+		if (stub->breakpoints[i].addr == addr) break;
+	}
+	// a 0000 in the program itself
+	if (i == stub->bp_count) return TRAP_OPCODE;
+
+	stub->signal = SIG_TRAP;
+	serve(stub, chip8);
+	return chip8->opcode;
+}
+
+uint16_t gdb_stub_orig(const gdb_stub_t *stub, uint16_t addr) {
+	for (size_t i = 0; i < stub->bp_count; i++) {
+		if (stub->breakpoints[i].addr == addr) return stub->breakpoints[i].orig;
+	}
+	return TRAP_OPCODE;
+}
+
+void gdb_stub_watch(gdb_stub_t *stub, chip8_t *chip8, uint16_t addr, uint16_t len, int write) {
+	for (size_t i = 0; i < stub->wp_count; i++) {
+		gdb_watchpoint_t *wp = &stub->watchpoints[i];
+
+		if (wp->type == WATCH_WRITE && !write) continue;
+		if (wp->type == WATCH_READ && write) continue;
+		if (addr >= wp->addr + wp->len || wp->addr >= addr + len) continue;
+
+		// reported once the instruction has finished
+		stub->signal = SIG_TRAP;
+		stub->watch_type = wp->type;
+		stub->watch_addr = wp->addr;
+		chip8->trapped = 1;
+		return;
+	}
+}
+
+void gdb_stub_stop(gdb_stub_t *stub, chip8_t *chip8) {
+	if (stub == NULL) {
+		chip8->trapped = 0;
+		return;
+	}
+	serve(stub, chip8);
+}
+
+void gdb_stub_reload(gdb_stub_t *stub, chip8_t *chip8) {
+	for (size_t i = 0; i < stub->bp_count; i++) {
+		gdb_breakpoint_t *bp = &stub->breakpoints[i];
+		bp->orig = chip8_peek16(chip8, bp->addr);
+		chip8_poke(chip8, bp->addr, TRAP_OPCODE >> 8);
+		chip8_poke(chip8, bp->addr + 1, TRAP_OPCODE & 0xFF);
+	}
+	// the reset reloaded the first instruction before the trap was back
+	chip8->opcode = chip8_peek16(chip8, chip8->PC - 2);
+}
+
+void gdb_stub_detach(gdb_stub_t *stub, chip8_t *chip8) {
+	while (stub->bp_count > 0) {
+		remove_breakpoint(stub, chip8, stub->breakpoints[0].addr);
+	}
+	stub->wp_count = 0;
+	resume(stub, chip8);
+
+	if (stub->client_fd >= 0) {
+		close(stub->client_fd);
+		printf("gdb detached\n");
+	}
+	stub->client_fd = -1;
+	chip8->debugger = NULL;
+}
+
+void gdb_stub_close(gdb_stub_t *stub, chip8_t *chip8) {
+	gdb_stub_detach(stub, chip8);
+	if (stub->listen_fd >= 0) close(stub->listen_fd);
+	stub->listen_fd = -1;
+	if (stub->path[0] != '\0') unlink(stub->path);
+}
+
+static int read_char(gdb_stub_t *stub) {
+	uint8_t c;
+	if (recv(stub->client_fd, &c, 1, 0) != 1) return -1;
+	return c;
+}
+
+static int read_packet(gdb_stub_t *stub, char *buf, size_t max) {
+	for (;;) {
+		int c;
+		// skip acks and ctrl-c until the start of a packet
+		do {
+			c = read_char(stub);
+			if (c < 0) return -1;
+		} while (c != '$');
+
+		size_t len = 0;
+		uint8_t sum = 0;
+		while ((c = read_char(stub)) != '#') {
+			if (c < 0) return -1;
+			if (len < max - 1) buf[len++] = c;
+			sum += c;
+		}
+		int hi = read_char(stub);
+		int lo = read_char(stub);
+		if (hi < 0 || lo < 0) return -1;
+
+		if (from_hex(hi) << 4 == (sum & 0xF0) && from_hex(lo) == (sum & 0xF)) {
+			send(stub->client_fd, "+", 1, MSG_NOSIGNAL);
+			buf[len] = '\0';
+			return len;
+		}
+		send(stub->client_fd, "-", 1, MSG_NOSIGNAL);
+	}
+}
+
+static void send_packet(gdb_stub_t *stub, const char *data) {
+	char buf[PACKET_MAX + 4];
+	size_t len = strlen(data);
+	uint8_t sum = 0;
+
+	buf[0] = '$';
+	for (size_t i = 0; i < len; i++) {
+		buf[i + 1] = data[i];
+		sum += data[i];
+	}
+	buf[len + 1] = '#';
+	buf[len + 2] = hex[sum >> 4];
+	buf[len + 3] = hex[sum & 0xF];
+	// the ack is skipped by read_packet()
+	send(stub->client_fd, buf, len + 4, MSG_NOSIGNAL);
+}
+
+static void send_stop(gdb_stub_t *stub) {
+	char buf[32];
+
+	if (stub->watch_type) {
+		const char *kind =
+			stub->watch_type == WATCH_WRITE ? "watch" :
+			stub->watch_type == WATCH_READ ? "rwatch" : "awatch";
+		snprintf(buf, sizeof(buf), "T%02x%s:%x;", stub->signal, kind, stub->watch_addr);
+	}
+	else snprintf(buf, sizeof(buf), "S%02x", stub->signal);
+	send_packet(stub, buf);
+}
+
+static void serve(gdb_stub_t *stub, chip8_t *chip8) {
+	char buf[PACKET_MAX];
+	char out[PACKET_MAX];
+	uint8_t regs[REG_BYTES];
+
+	// a fresh client asks with '?' itself
+	if (stub->resumed) send_stop(stub);
+	stub->resumed = 0;
+
+	for (;;) {
+		if (read_packet(stub, buf, sizeof(buf)) < 0) {
+			gdb_stub_detach(stub, chip8);
+			return;
+		}
+
+		switch (buf[0]) {
+		case '?':
+			send_stop(stub);
+			break;
+		case 'g':
+			read_registers(chip8, regs);
+			to_hex(out, regs, REG_BYTES);
+			send_packet(stub, out);
+			break;
+		case 'G':
+			read_registers(chip8, regs);
+			parse_hex(regs, buf + 1, REG_BYTES);
+			write_registers(chip8, regs);
+			send_packet(stub, "OK");
+			break;
+		case 'p':
+		case 'P': {
+			char *end;
+			size_t offset;
+			size_t size = reg_layout(strtoul(buf + 1, &end, 16), &offset);
+
+			if (size == 0) {
+				send_packet(stub, "E01");
+				break;
+			}
+			read_registers(chip8, regs);
+			if (buf[0] == 'p') {
+				to_hex(out, regs + offset, size);
+				send_packet(stub, out);
+				break;
+			}
+			if (*end != '=' || parse_hex(regs + offset, end + 1, size) != size) {
+				send_packet(stub, "E02");
+				break;
+			}
+			write_registers(chip8, regs);
+			send_packet(stub, "OK");
+			break;
+		}
+		case 'm':
+		case 'M': {
+			char *end;
+			unsigned long addr = strtoul(buf + 1, &end, 16);
+			unsigned long len = strtoul(end + 1, &end, 16);
+			uint8_t data[PACKET_MAX / 2];
+
+			if (addr > chip8->mem_mask || len > chip8->mem_mask + 1u - addr || len > sizeof(data) - 1) {
+				send_packet(stub, "E01");
+				break;
+			}
+			if (buf[0] == 'm') {
+				for (size_t i = 0; i < len; i++) data[i] = peek(stub, chip8, addr + i);
+				to_hex(out, data, len);
+				send_packet(stub, out);
+				break;
+			}
+			if (*end != ':' || parse_hex(data, end + 1, len) != len) {
+				send_packet(stub, "E02");
+				break;
+			}
+			for (size_t i = 0; i < len; i++) poke(stub, chip8, addr + i, data[i]);
+			send_packet(stub, "OK");
+			break;
+		}
+		case 'c':
+			resume(stub, chip8);
+			stub->resumed = 1;
+			return;
+		case 's':
+			step(stub, chip8);
+			if (!chip8->running) {
+				send_packet(stub, "W00");
+				gdb_stub_detach(stub, chip8);
+				return;
+			}
+			send_stop(stub);
+			break;
+		case 'Z':
+		case 'z':
+			handle_point(stub, chip8, buf);
+			break;
+		case 'k':
+			chip8->running = 0;
+			gdb_stub_detach(stub, chip8);
+			return;
+		case 'D':
+			send_packet(stub, "OK");
+			gdb_stub_detach(stub, chip8);
+			return;
+		case 'H':
+			send_packet(stub, "OK");
+			break;
+		case 'q':
+			if (strncmp(buf, "qSupported", 10) == 0) {
+				snprintf(out, sizeof(out), "PacketSize=%x;qXfer:features:read+", PACKET_MAX);
+				send_packet(stub, out);
+			}
+			else if (strncmp(buf, "qXfer:features:read:", 20) == 0) read_features(stub, buf + 20);
+			else if (strcmp(buf, "qAttached") == 0) send_packet(stub, "1");
+			else if (strcmp(buf, "qC") == 0) send_packet(stub, "QC1");
+			else if (strcmp(buf, "qfThreadInfo") == 0) send_packet(stub, "m1");
+			else if (strcmp(buf, "qsThreadInfo") == 0) send_packet(stub, "l");
+			else send_packet(stub, "");
+			break;
+		default:
+			// unsupported packet
+			send_packet(stub, "");
+			break;
+		}
+	}
+}
+
+static void resume(gdb_stub_t *stub, chip8_t *chip8) {
+	uint16_t addr = chip8->PC - 2;
+
+	// the PC or the memory under it may have been changed by the client
+	chip8->opcode = (peek(stub, chip8, addr) << 8) + peek(stub, chip8, addr + 1);
+	chip8->trapped = 0;
+	stub->watch_type = 0;
+}
+
+static void step(gdb_stub_t *stub, chip8_t *chip8) {
+	resume(stub, chip8);
+	decode_and_exec(chip8);
+	fetch(chip8);
+
+	// a watchpoint may have fired, it is reported with this step
+	chip8->trapped = 0;
+	stub->signal = SIG_TRAP;
+}
+
+static uint8_t peek(gdb_stub_t *stub, chip8_t *chip8, uint16_t addr) {
+	for (size_t i = 0; i < stub->bp_count; i++) {
+		gdb_breakpoint_t *bp = &stub->breakpoints[i];
+		if (addr == bp->addr) return bp->orig >> 8;
+		if (addr == bp->addr + 1) return bp->orig & 0xFF;
+	}
+	return chip8_peek(chip8, addr);
+}
+
+static void poke(gdb_stub_t *stub, chip8_t *chip8, uint16_t addr, uint8_t val) {
+	// keep the trap in place, the write goes to the saved instruction
+	for (size_t i = 0; i < stub->bp_count; i++) {
+		gdb_breakpoint_t *bp = &stub->breakpoints[i];
+		if (addr == bp->addr) {
+			bp->orig = (bp->orig & 0x00FF) | val << 8;
+			return;
+		}
+		if (addr == bp->addr + 1) {
+			bp->orig = (bp->orig & 0xFF00) | val;
+			return;
+		}
+	}
+	chip8_poke(chip8, addr, val);
+}
+
+static void read_registers(chip8_t *chip8, uint8_t *regs) {
+	// report the address of the instruction about to run
+	uint16_t pc = chip8->PC - 2;
+
+	memcpy(regs, chip8->registers, 16);
+	regs[16] = chip8->I & 0xFF;
+	regs[17] = chip8->I >> 8;
+	regs[18] = pc & 0xFF;
+	regs[19] = pc >> 8;
+	regs[20] = chip8->stack.size;
+	regs[21] = chip8->DT;
+	regs[22] = chip8->ST;
+}
+
+static void write_registers(chip8_t *chip8, const uint8_t *regs) {
+	uint16_t pc = regs[18] | regs[19] << 8;
+
+	memcpy(chip8->registers, regs, 16);
+	chip8->I = regs[16] | regs[17] << 8;
+	if (pc != chip8->PC - 2 && pc <= chip8->mem_mask - 1) {
+		// the new instruction is loaded when the client resumes
+		chip8->PC = pc + 2;
+		chip8->halted = 0;
+	}
+	chip8->stack.size = regs[20] > 16 ? 16 : regs[20];
+	chip8->DT = regs[21];
+	chip8->ST = regs[22];
+}
+
+static size_t reg_layout(size_t n, size_t *offset) {
+	if (n >= REG_COUNT) return 0;
+	if (n < 16) {
+		*offset = n;
+		return 1;
+	}
+	// I and PC are 16 bit
+	if (n < 18) {
+		*offset = 16 + (n - 16) * 2;
+		return 2;
+	}
+	*offset = n + 2;
+	return 1;
+}
+
+static void read_features(gdb_stub_t *stub, const char *annex) {
+	char out[PACKET_MAX];
+	char *end;
+
+	if (strncmp(annex, "target.xml:", 11) != 0) {
+		send_packet(stub, "E00");
+		return;
+	}
+	unsigned long offset = strtoul(annex + 11, &end, 16);
+	unsigned long len = *end == ',' ? strtoul(end + 1, NULL, 16) : 0;
+	size_t size = sizeof(target_xml) - 1;
+
+	if (offset > size) {
+		send_packet(stub, "E01");
+		return;
+	}
+	// the XML has nothing that needs escaping
+	if (len > sizeof(out) - 2) len = sizeof(out) - 2;
+	if (len > size - offset) len = size - offset;
+	out[0] = offset + len < size ? 'm' : 'l';
+	memcpy(out + 1, target_xml + offset, len);
+	out[len + 1] = '\0';
+	send_packet(stub, out);
+}
+
+static void handle_point(gdb_stub_t *stub, chip8_t *chip8, char *buf) {
+	char *end;
+	int type = buf[1] - '0';
+	unsigned long addr = strtoul(buf + 3, &end, 16);
+	unsigned long len = strtoul(end + 1, NULL, 16);
+	int insert = buf[0] == 'Z';
+
+	if (buf[2] != ',' || addr > chip8->mem_mask) {
+		send_packet(stub, "E01");
+		return;
+	}
+
+	// software and hardware breakpoints are the same thing here
+	if (type == 0 || type == 1) {
+		int err = insert ? insert_breakpoint(stub, chip8, addr) : remove_breakpoint(stub, chip8, addr);
+		send_packet(stub, err ? "E02" : "OK");
+		return;
+	}
+	if (type < WATCH_WRITE || type > WATCH_ACCESS) {
+		send_packet(stub, "");
+		return;
+	}
+
+	size_t i;
+	for (i = 0; i < stub->wp_count; i++) {
+		gdb_watchpoint_t *wp = &stub->watchpoints[i];
+		if (wp->addr == addr && wp->len == len && wp->type == type) break;
+	}
+	if (insert) {
+		if (i == stub->wp_count) {
+			if (stub->wp_count == GDB_MAX_WATCHPOINTS) {
+				send_packet(stub, "E02");
+				return;
+			}
+			stub->watchpoints[stub->wp_count++] = (gdb_watchpoint_t){ addr, len, type };
+		}
+	}
+	else if (i < stub->wp_count) {
+		stub->watchpoints[i] = stub->watchpoints[--stub->wp_count];
+	}
+	send_packet(stub, "OK");
+}
+
+static int insert_breakpoint(gdb_stub_t *stub, chip8_t *chip8, uint16_t addr) {
+	// past the end in classic mode it would land on a wrapped address
+	if (addr > chip8->mem_mask - 1) return 1;
+
+	for (size_t i = 0; i < stub->bp_count; i++) {
+		uint16_t other = stub->breakpoints[i].addr;
+		if (other == addr) return 0;
+		// the traps would overlap
+		if (other + 1 == addr || addr + 1 == other) return 1;
+	}
+	if (stub->bp_count == GDB_MAX_BREAKPOINTS) return 1;
+
+	gdb_breakpoint_t *bp = &stub->breakpoints[stub->bp_count++];
+	bp->addr = addr;
+	bp->orig = (chip8_peek(chip8, addr) << 8) + chip8_peek(chip8, addr + 1);
+	chip8_poke(chip8, addr, TRAP_OPCODE >> 8);
+	chip8_poke(chip8, addr + 1, TRAP_OPCODE & 0xFF);
+	return 0;
+}
+
+static int remove_breakpoint(gdb_stub_t *stub, chip8_t *chip8, uint16_t addr) {
+	for (size_t i = 0; i < stub->bp_count; i++) {
+		gdb_breakpoint_t bp = stub->breakpoints[i];
+		if (bp.addr != addr) continue;
+
+		stub->breakpoints[i] = stub->breakpoints[--stub->bp_count];
+		chip8_poke(chip8, addr, bp.orig >> 8);
+		chip8_poke(chip8, addr + 1, bp.orig & 0xFF);
+		return 0;
+	}
+	return 1;
+}
@@ -1,8 +1,34 @@
 #include "../include/input.h"
+#include "../include/latency.h"
 #include "SDL2/SDL.h"
 
+// hex key of an SDL key, -1 if it isn't mapped
+static int map_key(SDL_Keycode sym) {
+	switch (sym) {
+	case SDLK_1: return K_1;
+	case SDLK_2: return K_2;
+	case SDLK_3: return K_3;
+	case SDLK_4: return K_4;
+	case SDLK_q: return K_Q;
+	case SDLK_w: return K_W;
+	case SDLK_e: return K_E;
+	case SDLK_r: return K_R;
+	case SDLK_a: return K_A;
+	case SDLK_s: return K_S;
+	case SDLK_d: return K_D;
+	case SDLK_f: return K_F;
+	case SDLK_z: return K_Z;
+	case SDLK_x: return K_X;
+	case SDLK_c: return K_C;
+	case SDLK_v: return K_V;
+	default: return -1;
+	}
+}
+
 void handle_input(chip8_t *chip8) {
 	SDL_Event e;
+	int k;
+
 	while (SDL_PollEvent(&e)) {
 		switch(e.type) {
 		case SDL_QUIT:
@@ -11,11 +37,13 @@ void handle_input(chip8_t *chip8) {
 
 		case SDL_KEYUP:
 			// clear out the key
-			chip8->key = 0;
-			return;
+			k = map_key(e.key.keysym.sym);
+			if (k < 0 || !(chip8->keys & 1 << k)) break;
+			chip8->keys &= ~(1 << k);
+			if (chip8->latency) latency_key(chip8->latency);
+			break;
 
 		case SDL_KEYDOWN:
-
 			switch (e.key.keysym.sym) {
 			case SDLK_ESCAPE:
 				chip8->running = 0;
@@ -25,77 +53,29 @@ void handle_input(chip8_t *chip8) {
 				if (!chip8->paused) printf("PAUSE\n");
 				chip8->paused = !chip8->paused;
 				return;
-
-			case SDLK_1:
-				printf("Pressed 1\n");
-				if (!chip8->paused) chip8->key = K_1;
-				break;
-			case SDLK_2:
-				printf("Pressed 2\n");
-				if (!chip8->paused) chip8->key = K_2;
-				break;
-			case SDLK_3:
-				printf("Pressed 3\n");
-				if (!chip8->paused) chip8->key = K_3;
-				break;
-			case SDLK_4:
-				printf("Pressed 4\n");
-				if (!chip8->paused) chip8->key = K_4;
-				break;
-			case SDLK_q:
-				printf("Pressed Q\n");
-				if (!chip8->paused) chip8->key = K_Q;
-				break;
-			case SDLK_w:
-				printf("Pressed W\n");
-				if (!chip8->paused) chip8->key = K_W;
-				break;
-			case SDLK_e:
-				printf("Pressed E\n");
-				if (!chip8->paused) chip8->key = K_E;
-				break;
-			case SDLK_r:
-				printf("Pressed R\n");
-				if (!chip8->paused) chip8->key = K_R;
-				break;
-			case SDLK_a:
-				printf("Pressed A\n");
-				if (!chip8->paused) chip8->key = K_A;
-				break;
-			case SDLK_s:
-				printf("Pressed S\n");
-				if (!chip8->paused) chip8->key = K_S;
-				break;
-			case SDLK_d:
-				printf("Pressed D\n");
-				if (!chip8->paused) chip8->key = K_D;
-				break;
-			case SDLK_f:
-				printf("Pressed F\n");
-				if (!chip8->paused) chip8->key = K_F;
-				break;	
-			case SDLK_z:
-				printf("Pressed Z\n");
-				if (!chip8->paused) chip8->key = K_Z;
-				break;
-			case SDLK_x:
-				printf("Pressed X\n");
-				if (!chip8->paused) chip8->key = K_X;
-				break;
-			case SDLK_c:
-				printf("Pressed C\n");
-				if (!chip8->paused) chip8->key = K_C;
-				break;
-			case SDLK_v:
-				printf("Pressed V\n");
-				if (!chip8->paused) chip8->key = K_V;
-				break;
 			default:
+				k = map_key(e.key.keysym.sym);
+				// key repeat, nothing changed
+				if (k < 0 || chip8->paused || chip8->keys & 1 << k) break;
+				#ifdef DEBUG
+				printf("Pressed %X\n", k);
+				#endif
+				chip8->keys |= 1 << k;
+				if (chip8->latency) latency_key(chip8->latency);
 				break;
 			}
+			break;
 
 		default:
 			break;
 		}
 	}
-}
\ No newline at end of file
+}
+
+uint16_t bot_keys(uint32_t *rng, uint16_t keys) {
+	*rng ^= *rng << 13;
+	*rng ^= *rng >> 17;
+	*rng ^= *rng << 5;
+	if (*rng % 8) return keys;
+	return (*rng >> 8) % 3 ? 1 << (*rng >> 12) % 16 : 0;
+}
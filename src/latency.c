@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/latency.h"
+#include "../include/clock.h"
+
+static int cmp_u32(const void *a, const void *b);
+// nearest rank percentile of the sorted samples
+static uint32_t percentile(const latency_t *lat, int p);
+
+void latency_init(latency_t *lat, uint32_t inject_ms, SDL_Keycode key, uint32_t count) {
+	memset(lat, 0, sizeof(latency_t));
+	lat->inject_ms = inject_ms;
+	lat->inject_left = count;
+	lat->inject_key = key;
+	lat->inject_next = now_ns() + inject_ms * 1000000ull;
+}
+
+void latency_key(latency_t *lat) {
+	if (lat->pending) lat->unanswered++;
+	lat->pending = now_ns();
+}
+
+void latency_present(latency_t *lat, const chip8_t *chip8) {
+	// the same pixels again, nothing new reached the screen
+	if (lat->hires == chip8->hires && memcmp(lat->screen, chip8->screen, sizeof(lat->screen)) == 0) return;
+	memcpy(lat->screen, chip8->screen, sizeof(lat->screen));
+	lat->hires = chip8->hires;
+
+	if (lat->pending == 0) return;
+	if (lat->count == LAT_MAX_SAMPLES) lat->dropped++;
+	else lat->samples[lat->count++] = (now_ns() - lat->pending) / 1000;
+	lat->pending = 0;
+}
+
+int latency_inject(latency_t *lat) {
+	if (lat->inject_ms == 0) return 1;
+
+	uint64_t now = now_ns();
+	if (now < lat->inject_next) return 1;
+	if (lat->inject_left == 0 && !lat->inject_down) return 0;
+
+	// press for half the period, released for the other half
+	SDL_Event e;
+	memset(&e, 0, sizeof(e));
+	e.type = lat->inject_down ? SDL_KEYUP : SDL_KEYDOWN;
+	e.key.keysym.sym = lat->inject_key;
+	if (SDL_PushEvent(&e) < 0) {
+		fprintf(stderr, "Error injecting key event! %s\n", SDL_GetError());
+	}
+
+	if (!lat->inject_down) lat->inject_left--;
+	lat->inject_down = !lat->inject_down;
+	lat->inject_next = now + lat->inject_ms * 500000ull;
+	return 1;
+}
+
+void latency_report(latency_t *lat) {
+	if (lat->count == 0) {
+		printf("latency: no samples, %" PRIu64 " unanswered\n", lat->unanswered + (lat->pending != 0));
+		return;
+	}
+	qsort(lat->samples, lat->count, sizeof(uint32_t), cmp_u32);
+
+	printf("latency: %zu samples, %" PRIu64 " unanswered, %" PRIu64 " dropped\n",
+		lat->count, lat->unanswered + (lat->pending != 0), lat->dropped);
+	printf("latency: p50 %.3f ms, p95 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+		percentile(lat, 50) / 1000.0, percentile(lat, 95) / 1000.0,
+		percentile(lat, 99) / 1000.0, lat->samples[lat->count - 1] / 1000.0);
+
+	size_t buckets[LAT_BUCKETS] = {0};
+	size_t most = 0;
+	for (size_t i = 0; i < lat->count; i++) {
+		// bucket n holds [2^(n-1), 2^n) ms, bucket 0 below 1 ms
+		uint32_t ms = lat->samples[i] / 1000;
+		int b = ms ? 32 - __builtin_clz(ms) : 0;
+		if (b >= LAT_BUCKETS) b = LAT_BUCKETS - 1;
+		if (++buckets[b] > most) most = buckets[b];
+	}
+	for (int b = 0; b < LAT_BUCKETS; b++) {
+		char bar[41];
+		size_t len = buckets[b] * 40 / most;
+
+		memset(bar, '#', len);
+		bar[len] = '\0';
+		if (b == LAT_BUCKETS - 1) printf("  >= %4d ms %8zu %s\n", 1 << (b - 1), buckets[b], bar);
+		else printf("  < %5d ms %8zu %s\n", 1 << b, buckets[b], bar);
+	}
+}
+
+static int cmp_u32(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static uint32_t percentile(const latency_t *lat, int p) {
+	size_t rank = (lat->count * p + 99) / 100;
+	return lat->samples[rank ? rank - 1 : 0];
+}
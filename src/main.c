@@ -1,24 +1,282 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "../include/chip8.h"
 #include "../include/input.h"
+#include "../include/display.h"
+#include "../include/gdbstub.h"
+#include "../include/term.h"
+#include "../include/netplay.h"
+#include "../include/latency.h"
+#include "../include/trace.h"
+#include "../include/reload.h"
+#include "../include/profile.h"
+#include "../include/clock.h"
+
+// give up after this many seconds without input from the peer
+#define NET_TIMEOUT 5
+// cycles between checks of the 60 Hz timer clock
+#define TIMER_POLL_CYCLES 64
+
+// too big for the stack
+static netplay_t net;
+static latency_t lat;
+static trace_t trace;
+static profile_t prof;
+
+static void usage(void) {
+	printf("Use: ch8 <rom-file> [--gdb <port|socket-path>] [--term | --braille]\n");
+	printf("     ch8 <rom-file> --net <local-port> <host:port> [--latency ms] [--jitter ms]\n");
+	printf("         [--loss percent] [--bot seed] [--frames n] [--headless]\n");
+	printf("     input-to-photon latency with SDL: [--measure] [--inject <period-ms> <key> <count>]\n");
+	printf("     binary execution trace: [--trace <file>], read it with ch8trace\n");
+	printf("     reload the ROM whenever it's rewritten: [--watch]\n");
+	printf("     profile, writes <prefix>.asm and <prefix>.folded at exit: [--profile <prefix>]\n");
+	printf("     64 KB of XO-CHIP memory for a ROM that fits in 4 KB: [--xo]\n");
+}
+
+// the machine runs one frame at a time at NET_FPS, in step with the peer
+static void run_netplay(chip8_t *chip8, int headless, uint32_t bot, uint32_t frames) {
+	struct timespec next;
+	uint16_t local = 0;
+	uint32_t stalled = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (chip8->running) {
+		if (chip8->latency && !latency_inject(chip8->latency)) chip8->running = 0;
+		// chip8->keys holds both players' keys while a frame runs
+		if (!headless) {
+			chip8->keys = local;
+			handle_input(chip8);
+			local = chip8->keys;
+			// a paused peer would desync
+			chip8->paused = 0;
+		}
+		if (bot) local = bot_keys(&bot, local);
+
+		if (net_frame(&net, chip8, local)) stalled = 0;
+		else if (++stalled == NET_TIMEOUT * NET_FPS) {
+			fprintf(stderr, "Error, no input from the peer for %d seconds\n", NET_TIMEOUT);
+			chip8->running = 0;
+		}
+		if (frames && net.frame >= frames) chip8->running = 0;
+
+		if (!headless && chip8->draw) {
+			displ_present(chip8);
+			chip8->draw = 0;
+		}
+
+		next.tv_nsec += 1000000000L / NET_FPS;
+		if (next.tv_nsec >= 1000000000L) {
+			next.tv_nsec -= 1000000000L;
+			next.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+	}
+	net_close(&net);
+}
 
 int main(int argc, char **argv) {
 	if (argc < 2) {
-		printf("Use: ch8 <rom-file>\n");
+		usage();
 		return 1;
 	}
 
 	// create it on the stack
-	chip8_t chip8;
+	chip8_t chip8 = {0};
+	gdb_stub_t stub = { .listen_fd = -1, .client_fd = -1 };
+	size_t gdb_poll = GDB_POLL_CYCLES;
+	// terminal front-end instead of SDL
+	term_t term;
+	int term_mode = -1;
+	size_t term_poll = TERM_POLL_CYCLES;
+	const char *gdb_addr = NULL;
+	// netplay
+	const char *net_port = NULL, *net_peer = NULL;
+	uint32_t latency = 0, jitter = 0, loss = 0, bot = 0, frames = 0;
+	int headless = 0;
+	// input-to-photon latency
+	int measure = 0;
+	uint32_t inject_ms = 0, inject_count = 0;
+	SDL_Keycode inject_key = 0;
+	size_t lat_poll = LAT_POLL_CYCLES;
+	const char *trace_path = NULL;
+	// DT and ST
+	size_t timer_poll = TIMER_POLL_CYCLES;
+	uint64_t next_tick;
+	// ROM hot-reload
+	reload_t reload = { .fd = -1 };
+	int watch = 0;
+	const char *profile_prefix = NULL;
+	size_t reload_poll_left = RELOAD_POLL_CYCLES;
 
-	if (init(&chip8, argv[1]) == 1) {
-		return 1;
+	for (int i = 2; i < argc; i++) {
+		if (strcmp(argv[i], "--gdb") == 0 && i + 1 < argc) gdb_addr = argv[++i];
+		else if (strcmp(argv[i], "--term") == 0) term_mode = TERM_HALFBLOCK;
+		else if (strcmp(argv[i], "--braille") == 0) term_mode = TERM_BRAILLE;
+		else if (strcmp(argv[i], "--net") == 0 && i + 2 < argc) {
+			net_port = argv[++i];
+			net_peer = argv[++i];
+		}
+		else if (strcmp(argv[i], "--latency") == 0 && i + 1 < argc) latency = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--jitter") == 0 && i + 1 < argc) jitter = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--loss") == 0 && i + 1 < argc) loss = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--bot") == 0 && i + 1 < argc) bot = strtoul(argv[++i], NULL, 0) | 1;
+		else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) frames = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--headless") == 0) headless = 1;
+		else if (strcmp(argv[i], "--measure") == 0) measure = 1;
+		else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) trace_path = argv[++i];
+		else if (strcmp(argv[i], "--watch") == 0) watch = 1;
+		else if (strcmp(argv[i], "--xo") == 0) chip8.xo = 1;
+		else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) profile_prefix = argv[++i];
+		else if (strcmp(argv[i], "--inject") == 0 && i + 3 < argc &&
+			strlen(argv[i + 2]) == 1 && strchr("1234qwerasdfzxcv", argv[i + 2][0])) {
+			measure = 1;
+			inject_ms = atoi(argv[++i]);
+			// SDL keycodes of digits and letters are their ASCII
+			inject_key = argv[++i][0];
+			inject_count = atoi(argv[++i]);
+		}
+		else {
+			usage();
+			return 1;
+		}
+	}
+
+	if (measure) {
+		if (headless || term_mode >= 0) {
+			fprintf(stderr, "Error, latency is measured on the SDL front-end\n");
+			return 1;
+		}
+		latency_init(&lat, inject_ms, inject_key, inject_count);
+		chip8.latency = &lat;
+	}
+
+	if (net_port != NULL) {
+		if (trace_path != NULL || profile_prefix != NULL) {
+			fprintf(stderr, "Error, rollbacks re-run frames, netplay can't be traced or profiled\n");
+			return 1;
+		}
+		if (watch) {
+			fprintf(stderr, "Error, a reload on one side would desync, netplay can't --watch\n");
+			return 1;
+		}
+		if (gdb_addr != NULL) {
+			fprintf(stderr, "Error, breakpoints would stall the peer, netplay can't be debugged\n");
+			return 1;
+		}
+		if (term_mode >= 0) {
+			fprintf(stderr, "Error, netplay runs in an SDL window or --headless\n");
+			return 1;
+		}
+		if (headless) {
+			chip8_reset(&chip8);
+			if (chip8_load_rom(&chip8, argv[1])) return 1;
+		}
+		else if (init(&chip8, argv[1]) == 1) return 1;
+
+		if (net_open(&net, net_port, net_peer)) {
+			chip8_detach(&chip8);
+			if (!headless) displ_destroy(&chip8);
+			return 1;
+		}
+		net.latency_ms = latency;
+		net.jitter_ms = jitter;
+		net.loss_pct = loss;
+
+		run_netplay(&chip8, headless, bot, frames);
+		if (measure) latency_report(&lat);
+		chip8_detach(&chip8);
+		if (!headless) displ_destroy(&chip8);
+		return 0;
 	}
 
+	if (term_mode < 0) {
+		if (init(&chip8, argv[1]) == 1) return 1;
+	}
+	else {
+		chip8_reset(&chip8);
+		if (chip8_load_rom(&chip8, argv[1])) return 1;
+		if (term_init(&term, term_mode)) return 1;
+	}
+
+	if (gdb_addr != NULL && gdb_stub_open(&stub, gdb_addr)) {
+		chip8.running = 0;
+	}
+	if (watch) {
+		// the trace has no record for a machine swapped underneath it,
+		// the profile would count one ROM's code against another's
+		if (trace_path != NULL || profile_prefix != NULL) {
+			fprintf(stderr, "Error, --watch can't be used with --trace or --profile\n");
+			chip8.running = 0;
+		}
+		else if (reload_open(&reload, argv[1])) chip8.running = 0;
+	}
+	if (trace_path != NULL && chip8.running) {
+		if (trace_open(&trace, trace_path, &chip8)) chip8.running = 0;
+		else chip8_set_hooks(&chip8, &trace, chip8.profile);
+	}
+
+	if (profile_prefix != NULL && chip8.running) {
+		if (profile_open(&prof, &chip8)) chip8.running = 0;
+		else chip8_set_hooks(&chip8, chip8.trace, &prof);
+	}
+
+	next_tick = now_ns() + 1000000000ull / 60;
 	while (chip8.running) {
-		handle_input(&chip8);
+		if (term_mode < 0) handle_input(&chip8);
 		decode_and_exec(&chip8);
 		fetch(&chip8);
+
+		if (term_mode >= 0) {
+			// keys and frames are handled at TERM_FPS
+			if (--term_poll == 0) {
+				term_update(&term, &chip8);
+				term_poll = TERM_POLL_CYCLES;
+			}
+		}
+		// check if screen needs to be updated
+		else if (chip8.draw == 1) {
+			displ_present(&chip8);
+			chip8.draw = 0;
+		}
+
+		// the loop isn't paced, the timers follow the wall clock
+		if (--timer_poll == 0) {
+			uint64_t now = now_ns();
+			while (now >= next_tick) {
+				chip8_tick_timers(&chip8);
+				next_tick += 1000000000ull / 60;
+			}
+			timer_poll = TIMER_POLL_CYCLES;
+		}
+
+		if (chip8.latency && --lat_poll == 0) {
+			if (!latency_inject(&lat)) chip8.running = 0;
+			lat_poll = LAT_POLL_CYCLES;
+		}
+
+		if (reload.fd >= 0 && --reload_poll_left == 0) {
+			if (reload_poll(&reload, &chip8)) gdb_stub_reload(&stub, &chip8);
+			reload_poll_left = RELOAD_POLL_CYCLES;
+		}
+
+		// look for a gdb client or a ctrl-c
+		if (stub.listen_fd >= 0 && --gdb_poll == 0) {
+			gdb_stub_poll(&stub, &chip8);
+			gdb_poll = GDB_POLL_CYCLES;
+		}
 	}
-}
\ No newline at end of file
+	gdb_stub_close(&stub, &chip8);
+	reload_close(&reload);
+	if (measure) latency_report(&lat);
+	if (chip8.trace) trace_close(&trace);
+	if (chip8.profile) profile_close(&prof, &chip8, profile_prefix);
+	chip8_detach(&chip8);
+
+	if (term_mode >= 0) term_destroy(&term);
+	// free the display and destroy SDL
+	else displ_destroy(&chip8);
+}
@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "../include/netplay.h"
+#include "../include/clock.h"
+
+/* Packet, big endian:
+	0  magic
+	4  first frame of the inputs
+	8  ack, we have the peer's input for frames below this
+	12 sync frame, UINT32_MAX if none
+	16 sync hash
+	20 input count, 3 bytes padding
+	24 inputs, 2 bytes each
+*/
+#define NET_MAGIC 0x43384e50	// "C8NP"
+#define NET_HEADER 24
+#define NET_NONE UINT32_MAX
+
+static uint32_t next_rand(netplay_t *net);
+static void put32(uint8_t *p, uint32_t v);
+static uint32_t get32(const uint8_t *p);
+
+// run frame f with the local and the (predicted) remote input, 1 if out of memory
+static int simulate(netplay_t *net, chip8_t *chip8, uint32_t f);
+// back to the earliest mispredicted frame and run the ones since again, 1 if out of memory
+static int rollback(netplay_t *net, chip8_t *chip8);
+static void check_sync(netplay_t *net);
+
+static void send_inputs(netplay_t *net);
+static void receive(netplay_t *net);
+// the simulated link, drops or delays outgoing packets
+static void link_send(netplay_t *net, const uint8_t *data, size_t len);
+static void link_flush(netplay_t *net);
+
+int net_open(netplay_t *net, const char *local_port, const char *remote) {
+	memset(net, 0, sizeof(netplay_t));
+	net->rollback_from = NET_NONE;
+	net->rng = getpid() ^ (uint32_t)now_ns();
+	if (net->rng == 0) net->rng = 1;
+
+	char host[256];
+	const char *port = strrchr(remote, ':');
+	if (port == NULL || (size_t)(port - remote) >= sizeof(host)) {
+		fprintf(stderr, "Error, expected host:port for the peer: %s\n", remote);
+		return 1;
+	}
+	memcpy(host, remote, port - remote);
+	host[port - remote] = '\0';
+
+	struct addrinfo hints = {0}, *res;
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+	int err = getaddrinfo(host, port + 1, &hints, &res);
+	if (err) {
+		fprintf(stderr, "Error resolving %s: %s\n", remote, gai_strerror(err));
+		return 1;
+	}
+	memcpy(&net->peer, res->ai_addr, sizeof(net->peer));
+	freeaddrinfo(res);
+
+	struct sockaddr_in local = {0};
+	local.sin_family = AF_INET;
+	local.sin_port = htons(atoi(local_port));
+	local.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	net->fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (net->fd < 0 || bind(net->fd, (struct sockaddr *)&local, sizeof(local)) < 0) {
+		perror("Error opening netplay socket");
+		if (net->fd >= 0) close(net->fd);
+		return 1;
+	}
+	fcntl(net->fd, F_SETFL, O_NONBLOCK);
+	return 0;
+}
+
+int net_frame(netplay_t *net, chip8_t *chip8, uint16_t keys) {
+	receive(net);
+	// the frames since can't be run again, the game can't go on
+	if (net->rollback_from < net->frame && rollback(net, chip8)) {
+		chip8->running = 0;
+		return 0;
+	}
+	check_sync(net);
+
+	// too far ahead of the peer, wait for its input
+	if (net->frame >= net->remote_confirmed + NET_MAX_ROLLBACK) {
+		net->stalls++;
+		send_inputs(net);
+		link_flush(net);
+		return 0;
+	}
+
+	net->local[(net->frame + NET_INPUT_DELAY) % NET_RING] = keys;
+	if (simulate(net, chip8, net->frame)) {
+		chip8->running = 0;
+		return 0;
+	}
+	net->frame++;
+
+	send_inputs(net);
+	link_flush(net);
+	return 1;
+}
+
+void net_close(netplay_t *net) {
+	// keep resending for a while, the peer may still need the last inputs
+	uint64_t deadline = now_ns() + (net->latency_ms + net->jitter_ms + 250) * 1000000ull;
+	while (now_ns() < deadline) {
+		send_inputs(net);
+		link_flush(net);
+		usleep(1000000 / NET_FPS);
+	}
+	close(net->fd);
+	for (size_t i = 0; i < NET_RING; i++) chip8_state_free(&net->states[i]);
+
+	printf("netplay: %u frames, %" PRIu64 " rollbacks, %" PRIu64 " frames re-run, %" PRIu64 " stalls, %" PRIu64 " desyncs\n",
+		net->frame, net->rollbacks, net->resim_frames, net->stalls, net->desyncs);
+	if (net->resim_frames > 0) {
+		double us = net->resim_ns / 1000.0 / net->resim_frames;
+		printf("netplay: re-run %.2f us/frame, %.0fx real time\n",
+			us, 1000000.0 / NET_FPS / us);
+	}
+}
+
+static uint32_t next_rand(netplay_t *net) {
+	// xorshift32
+	net->rng ^= net->rng << 13;
+	net->rng ^= net->rng >> 17;
+	net->rng ^= net->rng << 5;
+	return net->rng;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static uint32_t get32(const uint8_t *p) {
+	return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static int simulate(netplay_t *net, chip8_t *chip8, uint32_t f) {
+	uint32_t slot = f % NET_RING;
+
+	// predict the remote keys are still held
+	if (f >= net->remote_confirmed) {
+		net->remote[slot] = net->remote_confirmed ?
+			net->remote[(net->remote_confirmed - 1) % NET_RING] : 0;
+	}
+
+	if (chip8_save_state(chip8, &net->states[slot])) return 1;
+	chip8->keys = net->local[slot] | net->remote[slot];
+	chip8_run_frame(chip8, CYCLES_PER_FRAME);
+	return 0;
+}
+
+static int rollback(netplay_t *net, chip8_t *chip8) {
+	uint64_t start = now_ns();
+
+	if (chip8_load_state(chip8, &net->states[net->rollback_from % NET_RING])) return 1;
+	for (uint32_t f = net->rollback_from; f < net->frame; f++) {
+		if (simulate(net, chip8, f)) return 1;
+	}
+
+	net->rollbacks++;
+	net->resim_frames += net->frame - net->rollback_from;
+	net->resim_ns += now_ns() - start;
+	net->rollback_from = NET_NONE;
+	return 0;
+}
+
+static void check_sync(netplay_t *net) {
+	if (!net->sync_pending) return;
+
+	// the snapshot was overwritten already
+	if (net->sync_frame + NET_RING <= net->frame) {
+		net->sync_pending = 0;
+		return;
+	}
+	// not final here yet, a later input may still change it
+	if (net->sync_frame > net->remote_confirmed || net->sync_frame >= net->frame) return;
+
+	net->sync_pending = 0;
+	if (chip8_state_hash(&net->states[net->sync_frame % NET_RING]) != net->sync_hash) {
+		if (net->desyncs == 0) fprintf(stderr, "netplay: desync at frame %u\n", net->sync_frame);
+		net->desyncs++;
+	}
+}
+
+static void send_inputs(netplay_t *net) {
+	uint8_t pkt[NET_PACKET_MAX] = {0};
+	uint32_t end = net->frame + NET_INPUT_DELAY;
+	uint32_t first = net->remote_ack;
+	// latest frame whose snapshot is final here
+	uint32_t sync = net->remote_confirmed < net->frame ? net->remote_confirmed : net->frame - 1;
+
+	if (end - first > NET_RING) end = first + NET_RING;
+
+	put32(pkt, NET_MAGIC);
+	put32(pkt + 4, first);
+	put32(pkt + 8, net->remote_confirmed);
+	if (net->frame == 0) put32(pkt + 12, NET_NONE);
+	else {
+		put32(pkt + 12, sync);
+		put32(pkt + 16, chip8_state_hash(&net->states[sync % NET_RING]));
+	}
+	pkt[20] = end - first;
+
+	for (uint32_t f = first; f < end; f++) {
+		uint16_t keys = net->local[f % NET_RING];
+		pkt[NET_HEADER + (f - first) * 2] = keys >> 8;
+		pkt[NET_HEADER + (f - first) * 2 + 1] = keys & 0xFF;
+	}
+	link_send(net, pkt, NET_HEADER + (end - first) * 2);
+}
+
+static void receive(netplay_t *net) {
+	uint8_t pkt[NET_PACKET_MAX];
+	ssize_t len;
+
+	while ((len = recv(net->fd, pkt, sizeof(pkt), 0)) >= NET_HEADER) {
+		if (get32(pkt) != NET_MAGIC) continue;
+
+		uint32_t first = get32(pkt + 4);
+		uint32_t ack = get32(pkt + 8);
+		uint32_t count = pkt[20];
+		if (NET_HEADER + count * 2 > (size_t)len) continue;
+
+		if (ack > net->remote_ack) net->remote_ack = ack;
+		// hold on to a pending hash, newer ones may stay ahead of us forever
+		if (!net->sync_pending && get32(pkt + 12) != NET_NONE) {
+			net->sync_frame = get32(pkt + 12);
+			net->sync_hash = get32(pkt + 16);
+			net->sync_pending = 1;
+		}
+
+		for (uint32_t i = 0; i < count; i++) {
+			uint32_t f = first + i;
+			uint16_t keys = pkt[NET_HEADER + i * 2] << 8 | pkt[NET_HEADER + i * 2 + 1];
+
+			// inputs are confirmed in order, anything past a gap comes again
+			if (f < net->remote_confirmed) continue;
+			if (f > net->remote_confirmed) break;
+			if (f >= net->frame + NET_RING - NET_MAX_ROLLBACK) break;
+
+			// already run on a wrong guess
+			if (f < net->frame && net->remote[f % NET_RING] != keys && f < net->rollback_from) {
+				net->rollback_from = f;
+			}
+			net->remote[f % NET_RING] = keys;
+			net->remote_confirmed++;
+		}
+	}
+}
+
+static void link_send(netplay_t *net, const uint8_t *data, size_t len) {
+	if (net->loss_pct && next_rand(net) % 100 < net->loss_pct) return;
+
+	if (net->latency_ms == 0 && net->jitter_ms == 0) {
+		sendto(net->fd, data, len, 0, (struct sockaddr *)&net->peer, sizeof(net->peer));
+		return;
+	}
+	if (net->queued == NET_QUEUE) return;
+
+	net_delayed_t *d = &net->queue[net->queued++];
+	uint32_t delay = net->latency_ms + next_rand(net) % (net->jitter_ms + 1);
+	d->due = now_ns() + delay * 1000000ull;
+	d->len = len;
+	memcpy(d->data, data, len);
+}
+
+static void link_flush(netplay_t *net) {
+	uint64_t now = now_ns();
+	size_t kept = 0;
+
+	for (size_t i = 0; i < net->queued; i++) {
+		net_delayed_t *d = &net->queue[i];
+		if (d->due <= now) {
+			sendto(net->fd, d->data, d->len, 0, (struct sockaddr *)&net->peer, sizeof(net->peer));
+		}
+		else if (kept != i) net->queue[kept++] = *d;
+		else kept++;
+	}
+	net->queued = kept;
+}
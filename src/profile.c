@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/profile.h"
+#include "../include/disasm.h"
+
+// child of the current node for the routine, created on the first call
+static int enter(profile_t *prof, uint16_t routine);
+static void name(const profile_t *prof, uint16_t routine, char *out, size_t len);
+static void write_asm(const profile_t *prof, const chip8_t *chip8, FILE *fp);
+static void write_folded(const profile_t *prof, FILE *fp);
+
+int profile_open(profile_t *prof, const chip8_t *chip8) {
+	memset(prof, 0, sizeof(profile_t));
+	prof->counts = calloc(SYS_MEMORY, sizeof(uint64_t));
+	prof->calls = calloc(SYS_MEMORY, sizeof(uint64_t));
+	prof->node_cap = 256;
+	prof->nodes = calloc(prof->node_cap, sizeof(profile_node_t));
+	if (prof->counts == NULL || prof->calls == NULL || prof->nodes == NULL) {
+		fprintf(stderr, "Error allocating the profile!\n");
+		free(prof->counts);
+		free(prof->calls);
+		free(prof->nodes);
+		return 1;
+	}
+
+	// the PC points past the instruction run next
+	prof->nodes[0].routine = chip8->PC - 2;
+	prof->node_count = 1;
+	prof->depth = chip8->stack.size;
+	return 0;
+}
+
+void profile_stack(profile_t *prof, const chip8_t *chip8) {
+	prof->nodes[prof->current].self += prof->instr - prof->mark;
+	prof->mark = prof->instr;
+
+	while (prof->depth > chip8->stack.size && prof->current != 0) {
+		prof->current = prof->nodes[prof->current].parent;
+		prof->depth--;
+	}
+	// a call, the PC is at the routine already
+	while (prof->depth < chip8->stack.size) {
+		if (enter(prof, chip8->PC)) break;
+		prof->depth++;
+	}
+	// returned past the root, or out of memory, the tree follows from here
+	prof->depth = chip8->stack.size;
+}
+
+void profile_close(profile_t *prof, const chip8_t *chip8, const char *prefix) {
+	char path[4096];
+
+	prof->nodes[prof->current].self += prof->instr - prof->mark;
+
+	snprintf(path, sizeof(path), "%s.asm", prefix);
+	FILE *fp = fopen(path, "w");
+	if (fp == NULL) fprintf(stderr, "Error, opening profile output: %s\n", path);
+	else {
+		write_asm(prof, chip8, fp);
+		fclose(fp);
+	}
+
+	snprintf(path, sizeof(path), "%s.folded", prefix);
+	fp = fopen(path, "w");
+	if (fp == NULL) fprintf(stderr, "Error, opening profile output: %s\n", path);
+	else {
+		write_folded(prof, fp);
+		fclose(fp);
+	}
+
+	printf("profile: %" PRIu64 " instructions, %zu call chains, written to %s.asm and %s.folded\n",
+		prof->instr, prof->node_count, prefix, prefix);
+	free(prof->counts);
+	free(prof->calls);
+	free(prof->nodes);
+}
+
+static int enter(profile_t *prof, uint16_t routine) {
+	profile_node_t *cur = &prof->nodes[prof->current];
+	uint32_t i;
+
+	prof->calls[routine]++;
+	for (i = cur->child; i != 0; i = prof->nodes[i].sibling) {
+		if (prof->nodes[i].routine == routine) {
+			prof->current = i;
+			return 0;
+		}
+	}
+
+	if (prof->node_count == prof->node_cap) {
+		profile_node_t *nodes = realloc(prof->nodes, prof->node_cap * 2 * sizeof(profile_node_t));
+		if (nodes == NULL) {
+			fprintf(stderr, "Error growing the call tree, the call is counted in its caller\n");
+			return 1;
+		}
+		prof->nodes = nodes;
+		prof->node_cap *= 2;
+		cur = &prof->nodes[prof->current];
+	}
+	i = prof->node_count++;
+	memset(&prof->nodes[i], 0, sizeof(profile_node_t));
+	prof->nodes[i].routine = routine;
+	prof->nodes[i].parent = prof->current;
+	prof->nodes[i].sibling = cur->child;
+	cur->child = i;
+	prof->current = i;
+	return 0;
+}
+
+static void name(const profile_t *prof, uint16_t routine, char *out, size_t len) {
+	if (routine == prof->nodes[0].routine) snprintf(out, len, "main");
+	else snprintf(out, len, "sub_%03x", routine);
+}
+
+static void write_asm(const profile_t *prof, const chip8_t *chip8, FILE *fp) {
+	uint64_t *total = calloc(prof->node_count, sizeof(uint64_t));
+	uint64_t *inclusive = calloc(SYS_MEMORY, sizeof(uint64_t));
+	uint64_t *exclusive = calloc(SYS_MEMORY, sizeof(uint64_t));
+	uint8_t *entry = calloc(SYS_MEMORY, 1);
+	uint8_t *listed = calloc(SYS_MEMORY, 1);
+	double all = prof->instr ? prof->instr : 1;
+	char text[64];
+
+	if (total == NULL || inclusive == NULL || exclusive == NULL || entry == NULL || listed == NULL) {
+		fprintf(stderr, "Error allocating the profile report!\n");
+		goto out;
+	}
+
+	// children always come after their parent, one pass backwards sums the subtrees
+	for (size_t i = prof->node_count; i-- > 0; ) {
+		total[i] += prof->nodes[i].self;
+		if (i > 0) total[prof->nodes[i].parent] += total[i];
+	}
+	for (size_t i = 0; i < prof->node_count; i++) {
+		uint16_t routine = prof->nodes[i].routine;
+		int nested = 0;
+
+		exclusive[routine] += prof->nodes[i].self;
+		entry[routine] = 1;
+		// recursion, the outer call already counts this one
+		for (uint32_t p = i; p != 0 && !nested; ) {
+			p = prof->nodes[p].parent;
+			nested = prof->nodes[p].routine == routine;
+		}
+		if (!nested) inclusive[routine] += total[i];
+	}
+
+	fprintf(fp, "; %" PRIu64 " instructions\n;\n", prof->instr);
+	fprintf(fp, ";    inclusive              exclusive            calls  routine\n");
+	// hottest first, a selection sort is fine for the few routines a ROM has
+	for (;;) {
+		int best = -1;
+		for (int a = 0; a < SYS_MEMORY; a++) {
+			if (entry[a] && !listed[a] && (best < 0 || inclusive[a] > inclusive[best])) best = a;
+		}
+		if (best < 0) break;
+		listed[best] = 1;
+		name(prof, best, text, sizeof(text));
+		fprintf(fp, "; %12" PRIu64 " %7.2f%% %12" PRIu64 " %7.2f%% %8" PRIu64 "  %s\n", inclusive[best], inclusive[best] * 100 / all,
+			exclusive[best], exclusive[best] * 100 / all, prof->calls[best], text);
+	}
+
+	fprintf(fp, ";\n;        count        %%  addr  op\n");
+	int end = -1;
+	for (int a = 0; a < SYS_MEMORY; a++) {
+		if (prof->counts[a] == 0) continue;
+		// a gap between runs of executed code
+		if (end >= 0 && a != end) fprintf(fp, "\n");
+		if (entry[a]) {
+			name(prof, a, text, sizeof(text));
+			fprintf(fp, "%s:\t; inclusive %.2f%%, exclusive %.2f%%, %" PRIu64 " calls\n", text,
+				inclusive[a] * 100 / all, exclusive[a] * 100 / all, prof->calls[a]);
+		}
+
+		uint16_t op = chip8_peek16(chip8, a);
+		end = a + disasm(op, chip8_peek16(chip8, a + 2), text, sizeof(text));
+		fprintf(fp, "  %12" PRIu64 " %7.2f%%  %04x  %04x  %s\n", prof->counts[a], prof->counts[a] * 100 / all, a, op, text);
+	}
+
+out:
+	free(total);
+	free(inclusive);
+	free(exclusive);
+	free(entry);
+	free(listed);
+}
+
+static void write_folded(const profile_t *prof, FILE *fp) {
+	uint32_t chain[32];
+	char text[16];
+
+	for (size_t i = 0; i < prof->node_count; i++) {
+		if (prof->nodes[i].self == 0) continue;
+
+		// at most 16 deep, printed from the root
+		size_t n = 0;
+		for (uint32_t p = i; n < 32; p = prof->nodes[p].parent) {
+			chain[n++] = p;
+			if (p == 0) break;
+		}
+		while (n-- > 0) {
+			name(prof, prof->nodes[chain[n]].routine, text, sizeof(text));
+			fprintf(fp, "%s%c", text, n ? ';' : ' ');
+		}
+		fprintf(fp, "%" PRIu64 "\n", prof->nodes[i].self);
+	}
+}
@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "../include/reload.h"
+#include "../include/clock.h"
+
+int reload_open(reload_t *reload, const char *path) {
+	char dir[4096];
+	const char *slash = strrchr(path, '/');
+
+	memset(reload, 0, sizeof(reload_t));
+	reload->fd = -1;
+	reload->path = path;
+
+	if (slash == NULL) strcpy(dir, ".");
+	else if ((size_t)(slash - path) >= sizeof(dir)) {
+		fprintf(stderr, "Error, ROM path too long: %s\n", path);
+		return 1;
+	}
+	else {
+		// the root directory keeps its slash
+		memcpy(dir, path, slash - path + (slash == path));
+		dir[slash - path + (slash == path)] = '\0';
+	}
+	const char *name = slash ? slash + 1 : path;
+	if (strlen(name) >= sizeof(reload->name)) {
+		fprintf(stderr, "Error, ROM name too long: %s\n", name);
+		return 1;
+	}
+	strcpy(reload->name, name);
+
+	reload->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (reload->fd < 0) {
+		perror("Error starting inotify");
+		return 1;
+	}
+	// written in place, or renamed/moved over the ROM
+	reload->wd = inotify_add_watch(reload->fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+	if (reload->wd < 0) {
+		perror("Error watching the ROM directory");
+		reload_close(reload);
+		return 1;
+	}
+	return 0;
+}
+
+int reload_poll(reload_t *reload, chip8_t *chip8) {
+	// aligned for the events, a burst of them is read in one go
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+	int changed = 0;
+
+	if (reload->fd < 0) return 0;
+	while ((len = read(reload->fd, buf, sizeof(buf))) > 0) {
+		for (char *p = buf; p < buf + len; ) {
+			struct inotify_event *e = (struct inotify_event *)p;
+			if (e->len > 0 && strcmp(e->name, reload->name) == 0) changed = 1;
+			p += sizeof(struct inotify_event) + e->len;
+		}
+	}
+	if (!changed) return 0;
+
+	uint64_t start = now_ns();
+	// a failed load leaves the old ROM running
+	if (chip8_load_rom(chip8, reload->path)) return 0;
+	chip8->draw = 1;
+	reload->reloads++;
+
+	uint64_t took = now_ns() - start;
+	if (took > reload->slowest_ns) reload->slowest_ns = took;
+	return 1;
+}
+
+void reload_close(reload_t *reload) {
+	if (reload->fd < 0) return;
+	close(reload->fd);
+	reload->fd = -1;
+
+	if (reload->reloads > 0) {
+		printf("reload: %" PRIu64 " reloads, slowest %.1f us\n", reload->reloads, reload->slowest_ns / 1000.0);
+	}
+}
@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "../include/term.h"
+#include "../include/input.h"
+#include "../include/clock.h"
+
+// longest cell: cursor move plus a 3 byte UTF-8 glyph
+#define CELL_MAX 16
+#define FRAME_MAX (TERM_ROWS * TERM_COLS * CELL_MAX)
+
+// same layout as input.c
+static const char keymap[] = "1234qwerasdfzxcv";
+static const uint8_t keyvals[] = {
+	K_1, K_2, K_3, K_4,
+	K_Q, K_W, K_E, K_R,
+	K_A, K_S, K_D, K_F,
+	K_Z, K_X, K_C, K_V
+};
+
+static const int term_signals[] = { SIGINT, SIGTERM, SIGHUP, SIGQUIT };
+// the mode to go back to if a signal kills the process
+static struct termios saved_mode;
+
+static void term_write(const char *buf, size_t len);
+static void term_signal(int sig);
+// glyph of the cell at row, col for the current mode
+static uint8_t cell_glyph(term_t *term, chip8_t *chip8, int row, int col);
+// append the UTF-8 of a glyph, returns the bytes written
+static size_t put_glyph(term_t *term, char *out, uint8_t glyph);
+static void term_input(term_t *term, chip8_t *chip8);
+static void term_present(term_t *term, chip8_t *chip8);
+
+int term_init(term_t *term, int mode) {
+	memset(term, 0, sizeof(term_t));
+	term->mode = mode;
+
+	if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &term->saved) < 0) {
+		fprintf(stderr, "Error, terminal mode needs a tty on stdin\n");
+		return 1;
+	}
+
+	saved_mode = term->saved;
+	struct sigaction sa = { .sa_handler = term_signal, .sa_flags = SA_RESETHAND };
+	sigemptyset(&sa.sa_mask);
+	for (size_t i = 0; i < sizeof(term_signals) / sizeof(term_signals[0]); i++) {
+		sigaction(term_signals[i], &sa, NULL);
+	}
+
+	struct termios raw = term->saved;
+	// no echo, no line buffering, ctrl-c is read as a key
+	raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+	raw.c_iflag &= ~(IXON | ICRNL);
+	// read() returns at once, with or without input
+	raw.c_cc[VMIN] = 0;
+	raw.c_cc[VTIME] = 0;
+	tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+
+	// hide the cursor and clear
+	term_write("\x1b[?25l\x1b[2J", 10);
+	return 0;
+}
+
+void term_update(term_t *term, chip8_t *chip8) {
+	uint64_t now = now_ns();
+
+	if (now - term->last_frame < 1000000000ull / TERM_FPS) return;
+	term->last_frame = now;
+
+	term_input(term, chip8);
+	if (chip8->draw) {
+		term_present(term, chip8);
+		chip8->draw = 0;
+	}
+}
+
+void term_destroy(term_t *term) {
+	char buf[32];
+
+	// park the cursor below the frame and show it again
+	int len = snprintf(buf, sizeof(buf), "\x1b[%d;1H\x1b[?25h\n", term->rows + 1);
+	term_write(buf, len);
+	tcsetattr(STDIN_FILENO, TCSAFLUSH, &term->saved);
+	for (size_t i = 0; i < sizeof(term_signals) / sizeof(term_signals[0]); i++) {
+		signal(term_signals[i], SIG_DFL);
+	}
+}
+
+static void term_signal(int sig) {
+	// only async-signal-safe calls, then die of the signal as if unhandled
+	term_write("\x1b[?25h\n", 7);
+	tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved_mode);
+	raise(sig);
+}
+
+static void term_write(const char *buf, size_t len) {
+	while (len > 0) {
+		ssize_t n = write(STDOUT_FILENO, buf, len);
+		if (n <= 0) return;
+		buf += n;
+		len -= n;
+	}
+}
+
+static void term_input(term_t *term, chip8_t *chip8) {
+	char buf[64];
+	ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+	uint64_t now = now_ns();
+
+	for (ssize_t i = 0; i < n; i++) {
+		// escape or ctrl-c
+		if (buf[i] == 0x1b || buf[i] == 0x03) {
+			chip8->running = 0;
+			return;
+		}
+		if (buf[i] == ' ') {
+			chip8->paused = !chip8->paused;
+			continue;
+		}
+
+		const char *k = strchr(keymap, buf[i] | 0x20);
+		if (k == NULL || *k == '\0' || chip8->paused) continue;
+		uint8_t key = keyvals[k - keymap];
+		// the same key again while held is the terminal repeating it
+		if (chip8->keys & 1 << key) term->repeating |= 1 << key;
+		chip8->keys |= 1 << key;
+		term->key_time[key] = now;
+	}
+
+	// no repeat for a while, treat it as released
+	for (int key = 0; key < 16; key++) {
+		uint64_t hold = term->repeating & 1 << key ? TERM_KEY_HOLD_MS : TERM_KEY_DELAY_MS;
+		if (now - term->key_time[key] > hold * 1000000ull) {
+			chip8->keys &= ~(1 << key);
+			term->repeating &= ~(1 << key);
+		}
+	}
+}
+
+static uint8_t cell_glyph(term_t *term, chip8_t *chip8, int row, int col) {
+	if (term->mode == TERM_HALFBLOCK) {
+		// bit 0 top pixel, bit 1 bottom pixel
+		return (chip8_pixel(chip8, col, row * 2) != 0) | (chip8_pixel(chip8, col, row * 2 + 1) != 0) << 1;
+	}
+
+	// braille dots 1-8, the left column is 1 2 3 7 and the right 4 5 6 8
+	static const uint8_t dots[4][2] = {
+		{ 0x01, 0x08 },
+		{ 0x02, 0x10 },
+		{ 0x04, 0x20 },
+		{ 0x40, 0x80 }
+	};
+	uint8_t glyph = 0;
+
+	for (int y = 0; y < 4; y++) {
+		for (int x = 0; x < 2; x++) {
+			if (chip8_pixel(chip8, col * 2 + x, row * 4 + y)) glyph |= dots[y][x];
+		}
+	}
+	return glyph;
+}
+
+static size_t put_glyph(term_t *term, char *out, uint8_t glyph) {
+	if (term->mode == TERM_BRAILLE) {
+		// U+2800 + dots
+		out[0] = 0xE2;
+		out[1] = 0xA0 | glyph >> 6;
+		out[2] = 0x80 | (glyph & 0x3F);
+		return 3;
+	}
+
+	switch (glyph) {
+	case 0:
+		out[0] = ' ';
+		return 1;
+	case 1:
+		memcpy(out, "\xE2\x96\x80", 3);	// upper half block
+		return 3;
+	case 2:
+		memcpy(out, "\xE2\x96\x84", 3);	// lower half block
+		return 3;
+	default:
+		memcpy(out, "\xE2\x96\x88", 3);	// full block
+		return 3;
+	}
+}
+
+static void term_present(term_t *term, chip8_t *chip8) {
+	static char frame[FRAME_MAX];
+	size_t len = 0;
+	int rows = chip8_height(chip8) / 2;
+	int cols = chip8_width(chip8);
+	// where the terminal cursor is after the last glyph, -1 if unknown
+	int cur_row = -1, cur_col = -1;
+
+	// a redraw of the same pixels, nothing to send
+	if (term->valid && term->hires == chip8->hires &&
+		memcmp(term->screen, chip8->screen, sizeof(term->screen)) == 0) return;
+	memcpy(term->screen, chip8->screen, sizeof(term->screen));
+
+	// the frame changes size, start over from a clear terminal
+	if (term->valid && term->hires != chip8->hires) {
+		term_write("\x1b[2J", 4);
+		term->valid = 0;
+	}
+	term->hires = chip8->hires;
+
+	if (term->mode == TERM_BRAILLE) {
+		rows = chip8_height(chip8) / 4;
+		cols = chip8_width(chip8) / 2;
+	}
+	term->rows = rows;
+
+	for (int row = 0; row < rows; row++) {
+		for (int col = 0; col < cols; col++) {
+			uint8_t glyph = cell_glyph(term, chip8, row, col);
+
+			if (term->valid && term->cells[row][col] == glyph) continue;
+			term->cells[row][col] = glyph;
+
+			// the cursor already sits here after the previous glyph
+			if (row != cur_row || col != cur_col) {
+				len += snprintf(frame + len, CELL_MAX, "\x1b[%d;%dH", row + 1, col + 1);
+			}
+			len += put_glyph(term, frame + len, glyph);
+			cur_row = row;
+			cur_col = col + 1;
+		}
+	}
+	term->valid = 1;
+
+	term_write(frame, len);
+}
@@ -0,0 +1,515 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/trace.h"
+
+#define FILE_MAGIC "C8TR"
+#define BLOCK_MAGIC "C8BK"
+#define FILE_HEADER 8
+
+static void put16(uint8_t *p, uint16_t v);
+static void put32(uint8_t *p, uint32_t v);
+static void put64(uint8_t *p, uint64_t v);
+static uint16_t get16(const uint8_t *p);
+static uint32_t get32(const uint8_t *p);
+static uint64_t get64(const uint8_t *p);
+static uint8_t *put_varint(uint8_t *p, uint32_t v);
+static uint32_t zigzag(int16_t v);
+
+static void *writer(void *arg);
+// start a block with a keyframe of the machine
+static void begin_block(trace_t *trace, const chip8_t *chip8);
+// queue the block for the writer and start the next one
+static void flush_block(trace_t *trace, const chip8_t *chip8);
+
+// read block i and load its keyframe into the machine
+static int load_block(trace_reader_t *reader, size_t i);
+// returns -1 past the end of the block
+static int64_t get_varint(trace_reader_t *reader);
+// the effects on the screen and the stack, everything else is in the record
+static void replay(trace_reader_t *reader, const trace_record_t *rec, const uint8_t *sprite);
+
+int trace_open(trace_t *trace, const char *path, const chip8_t *chip8) {
+	memset(trace, 0, sizeof(trace_t));
+
+	trace->fp = fopen(path, "wb");
+	if (trace->fp == NULL) {
+		fprintf(stderr, "Error, opening trace file: %s\n", path);
+		return 1;
+	}
+	uint8_t header[FILE_HEADER];
+	memcpy(header, FILE_MAGIC, 4);
+	put32(header + 4, TRACE_VERSION);
+	fwrite(header, 1, FILE_HEADER, trace->fp);
+
+	pthread_mutex_init(&trace->lock, NULL);
+	pthread_cond_init(&trace->cond, NULL);
+	// the PC points past the instruction run next
+	trace->pc = chip8->PC - 2;
+	begin_block(trace, chip8);
+
+	if (pthread_create(&trace->thread, NULL, writer, trace)) {
+		fprintf(stderr, "Error starting the trace writer!\n");
+		fclose(trace->fp);
+		return 1;
+	}
+	return 0;
+}
+
+void trace_close(trace_t *trace) {
+	trace_block_t *b = &trace->blocks[trace->head];
+
+	pthread_mutex_lock(&trace->lock);
+	if (b->records > 0) {
+		put32(b->data + 4, b->len);
+		put32(b->data + 8, b->records);
+		trace->bytes += b->len;
+		trace->queued++;
+	}
+	trace->done = 1;
+	pthread_cond_broadcast(&trace->cond);
+	pthread_mutex_unlock(&trace->lock);
+
+	pthread_join(trace->thread, NULL);
+	fclose(trace->fp);
+	pthread_mutex_destroy(&trace->lock);
+	pthread_cond_destroy(&trace->cond);
+
+	printf("trace: %" PRIu64 " instructions, %u frames, %" PRIu64 " bytes, %.2f bytes/instruction, %" PRIu64 " writer stalls\n",
+		trace->instr, trace->frame, trace->bytes,
+		trace->instr ? (double)trace->bytes / trace->instr : 0.0, trace->stalls);
+}
+
+void trace_exec(trace_t *trace, const chip8_t *chip8, uint16_t addr, uint16_t opcode) {
+	// FX0A waiting on a key, the record is written once it gets one
+	if (chip8->halted) return;
+
+	trace_block_t *b = &trace->blocks[trace->head];
+	uint8_t *start = b->data + b->len;
+	uint8_t *p = start + 1;
+	uint8_t flags = 0;
+
+	if (addr != trace->pc) {
+		flags |= TRACE_PC;
+		p = put_varint(p, zigzag(addr - trace->pc));
+	}
+	*p++ = opcode >> 8;
+	*p++ = opcode & 0xFF;
+
+	if (chip8->I != trace->I) {
+		flags |= TRACE_I;
+		p = put_varint(p, zigzag(chip8->I - trace->I));
+		trace->I = chip8->I;
+	}
+
+	uint16_t mask = 0;
+	for (int i = 0; i < 16; i++) {
+		if (chip8->registers[i] != trace->registers[i]) mask |= 1 << i;
+	}
+	if (mask) {
+		flags |= TRACE_REGS;
+		p = put_varint(p, mask);
+		for (int i = 0; i < 16; i++) {
+			if (mask & 1 << i) *p++ = chip8->registers[i];
+		}
+		memcpy(trace->registers, chip8->registers, 16);
+	}
+
+	if (trace->sprite_len) {
+		flags |= TRACE_SPRITE;
+		p = put_varint(p, trace->sprite_len);
+		memcpy(p, trace->sprite, trace->sprite_len);
+		p += trace->sprite_len;
+		trace->sprite_len = 0;
+	}
+
+	if (chip8->DT != trace->DT || chip8->ST != trace->ST) {
+		flags |= TRACE_TIMERS;
+		*p++ = trace->DT = chip8->DT;
+		*p++ = trace->ST = chip8->ST;
+	}
+
+	*start = flags;
+	b->len = p - b->data;
+	b->records++;
+	trace->pc = addr + 2;
+	trace->instr++;
+
+	if (b->len + TRACE_RECORD_MAX > TRACE_BLOCK_SIZE) flush_block(trace, chip8);
+}
+
+void trace_sprite(trace_t *trace, const uint8_t *sprite, size_t len) {
+	if (trace->sprite_len + len > sizeof(trace->sprite)) return;
+	memcpy(trace->sprite + trace->sprite_len, sprite, len);
+	trace->sprite_len += len;
+}
+
+void trace_frame(trace_t *trace, const chip8_t *chip8) {
+	trace_block_t *b = &trace->blocks[trace->head];
+	uint8_t *p = b->data + b->len;
+
+	p[0] = TRACE_FRAME;
+	p[1] = trace->DT = chip8->DT;
+	p[2] = trace->ST = chip8->ST;
+	b->len += 3;
+	b->records++;
+	trace->frame++;
+
+	if (b->len + TRACE_RECORD_MAX > TRACE_BLOCK_SIZE) flush_block(trace, chip8);
+}
+
+static void *writer(void *arg) {
+	trace_t *trace = arg;
+	int failed = 0;
+
+	pthread_mutex_lock(&trace->lock);
+	for (;;) {
+		while (trace->queued == 0 && !trace->done) pthread_cond_wait(&trace->cond, &trace->lock);
+		if (trace->queued == 0) break;
+
+		trace_block_t *b = &trace->blocks[trace->tail];
+		// the emulator doesn't touch queued blocks, write without the lock
+		pthread_mutex_unlock(&trace->lock);
+		if (fwrite(b->data, 1, b->len, trace->fp) != b->len && !failed) {
+			fprintf(stderr, "Error writing the trace file!\n");
+			failed = 1;
+		}
+		pthread_mutex_lock(&trace->lock);
+
+		trace->tail = (trace->tail + 1) % TRACE_BLOCKS;
+		trace->queued--;
+		pthread_cond_broadcast(&trace->cond);
+	}
+	pthread_mutex_unlock(&trace->lock);
+	return NULL;
+}
+
+static void begin_block(trace_t *trace, const chip8_t *chip8) {
+	trace_block_t *b = &trace->blocks[trace->head];
+	uint8_t *p = b->data;
+
+	memcpy(trace->registers, chip8->registers, 16);
+	trace->I = chip8->I;
+	trace->DT = chip8->DT;
+	trace->ST = chip8->ST;
+
+	// length and record count are filled in when the block is done
+	memcpy(p, BLOCK_MAGIC, 4);
+	p += 12;
+	put64(p, trace->instr);
+	put32(p + 8, trace->frame);
+	put16(p + 12, trace->pc);
+	put16(p + 14, trace->I);
+	p += 16;
+	memcpy(p, trace->registers, 16);
+	p += 16;
+	*p++ = chip8->stack.size;
+	for (int i = 0; i < 16; i++, p += 2) put16(p, chip8->stack.array[i]);
+	*p++ = chip8->DT;
+	*p++ = chip8->ST;
+	*p++ = chip8->planes;
+	*p++ = chip8->hires;
+	for (int plane = 0; plane < DISPLAY_PLANES; plane++) {
+		for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+			for (int i = 0; i < 16; i++) *p++ = chip8->screen[plane][y].w[i / 8] >> (56 - i % 8 * 8);
+		}
+	}
+
+	b->len = p - b->data;
+	b->records = 0;
+}
+
+static void flush_block(trace_t *trace, const chip8_t *chip8) {
+	trace_block_t *b = &trace->blocks[trace->head];
+
+	put32(b->data + 4, b->len);
+	put32(b->data + 8, b->records);
+	trace->bytes += b->len;
+
+	pthread_mutex_lock(&trace->lock);
+	trace->queued++;
+	trace->head = (trace->head + 1) % TRACE_BLOCKS;
+	pthread_cond_broadcast(&trace->cond);
+	// every buffer is waiting on the disk
+	if (trace->queued == TRACE_BLOCKS) trace->stalls++;
+	while (trace->queued == TRACE_BLOCKS) pthread_cond_wait(&trace->cond, &trace->lock);
+	pthread_mutex_unlock(&trace->lock);
+
+	begin_block(trace, chip8);
+}
+
+int trace_reader_open(trace_reader_t *reader, const char *path) {
+	uint8_t header[24];
+	size_t cap = 0;
+	long offset = FILE_HEADER;
+
+	memset(reader, 0, sizeof(trace_reader_t));
+	reader->fp = fopen(path, "rb");
+	if (reader->fp == NULL) {
+		fprintf(stderr, "Error, opening trace file: %s\n", path);
+		return 1;
+	}
+	if (fread(header, 1, FILE_HEADER, reader->fp) != FILE_HEADER ||
+		memcmp(header, FILE_MAGIC, 4) || get32(header + 4) != TRACE_VERSION) {
+		fprintf(stderr, "Error, not a version %d trace: %s\n", TRACE_VERSION, path);
+		trace_reader_close(reader);
+		return 1;
+	}
+
+	// a truncated last block is left out
+	while (fseek(reader->fp, offset, SEEK_SET) == 0 && fread(header, 1, 24, reader->fp) == 24) {
+		uint32_t len = get32(header + 4);
+		if (memcmp(header, BLOCK_MAGIC, 4) || len < TRACE_KEYFRAME_SIZE || len > TRACE_BLOCK_SIZE) break;
+
+		if (reader->blocks == cap) {
+			cap = cap ? cap * 2 : 64;
+			long *offsets = realloc(reader->offsets, cap * sizeof(long));
+			uint32_t *frames = realloc(reader->frames, cap * sizeof(uint32_t));
+			if (offsets) reader->offsets = offsets;
+			if (frames) reader->frames = frames;
+			if (offsets == NULL || frames == NULL) {
+				fprintf(stderr, "Error allocating the trace index!\n");
+				trace_reader_close(reader);
+				return 1;
+			}
+		}
+		reader->offsets[reader->blocks] = offset;
+		reader->frames[reader->blocks] = get32(header + 20);
+		reader->blocks++;
+		offset += len;
+	}
+
+	reader->data = malloc(TRACE_BLOCK_SIZE);
+	if (reader->data == NULL) {
+		fprintf(stderr, "Error allocating the trace buffer!\n");
+		trace_reader_close(reader);
+		return 1;
+	}
+	chip8_reset(&reader->machine);
+	if (reader->blocks == 0) return 0;
+	return load_block(reader, 0);
+}
+
+int trace_reader_next(trace_reader_t *reader, trace_record_t *rec) {
+	uint8_t sprite[64];
+
+	while (reader->left == 0) {
+		if (reader->block + 1 >= reader->blocks) return 0;
+		if (load_block(reader, reader->block + 1)) return -1;
+	}
+	if (reader->pos >= reader->len) return -1;
+
+	memset(rec, 0, sizeof(trace_record_t));
+	rec->flags = reader->data[reader->pos++];
+	reader->left--;
+
+	if (rec->flags & TRACE_FRAME) {
+		if (reader->pos + 2 > reader->len) return -1;
+		reader->machine.DT = reader->data[reader->pos++];
+		reader->machine.ST = reader->data[reader->pos++];
+		rec->frame = ++reader->frame;
+		rec->instr = reader->instr;
+		return 1;
+	}
+
+	// the machine's PC is the address expected next
+	rec->PC = reader->machine.PC;
+	if (rec->flags & TRACE_PC) {
+		int64_t v = get_varint(reader);
+		if (v < 0) return -1;
+		rec->PC += (v >> 1) ^ -(v & 1);
+	}
+	if (reader->pos + 2 > reader->len) return -1;
+	rec->opcode = reader->data[reader->pos] << 8 | reader->data[reader->pos + 1];
+	reader->pos += 2;
+
+	uint16_t I = reader->machine.I;
+	if (rec->flags & TRACE_I) {
+		int64_t v = get_varint(reader);
+		if (v < 0) return -1;
+		I += (v >> 1) ^ -(v & 1);
+	}
+
+	uint8_t values[16];
+	if (rec->flags & TRACE_REGS) {
+		int64_t v = get_varint(reader);
+		if (v < 0) return -1;
+		rec->regs = v;
+		for (int i = 0; i < 16; i++) {
+			if (!(rec->regs & 1 << i)) continue;
+			if (reader->pos >= reader->len) return -1;
+			values[i] = reader->data[reader->pos++];
+		}
+	}
+
+	if (rec->flags & TRACE_SPRITE) {
+		int64_t v = get_varint(reader);
+		if (v < 0 || v > (int64_t)sizeof(sprite) || reader->pos + v > reader->len) return -1;
+		rec->sprite_len = v;
+		memcpy(sprite, reader->data + reader->pos, v);
+		reader->pos += v;
+	}
+
+	// screen and stack from the state before the instruction, then the changes
+	replay(reader, rec, sprite);
+	reader->machine.I = I;
+	for (int i = 0; i < 16; i++) {
+		if (rec->regs & 1 << i) reader->machine.registers[i] = values[i];
+	}
+	if (rec->flags & TRACE_TIMERS) {
+		if (reader->pos + 2 > reader->len) return -1;
+		reader->machine.DT = reader->data[reader->pos++];
+		reader->machine.ST = reader->data[reader->pos++];
+	}
+
+	reader->machine.PC = rec->PC + 2;
+	rec->instr = reader->instr++;
+	rec->frame = reader->frame;
+	return 1;
+}
+
+int trace_reader_seek(trace_reader_t *reader, uint32_t frame) {
+	trace_record_t rec;
+	size_t block = 0;
+
+	// a block can start anywhere in a frame, take the last one started before it
+	while (block + 1 < reader->blocks && reader->frames[block + 1] < frame) block++;
+	if (reader->blocks == 0 || load_block(reader, block)) return 1;
+
+	while (reader->frame < frame) {
+		if (trace_reader_next(reader, &rec) <= 0) return 1;
+	}
+	return 0;
+}
+
+void trace_reader_close(trace_reader_t *reader) {
+	if (reader->fp != NULL) fclose(reader->fp);
+	free(reader->offsets);
+	free(reader->frames);
+	free(reader->data);
+	// the sprite pages written by the replay
+	if (reader->machine.image != NULL) chip8_detach(&reader->machine);
+}
+
+static void put16(uint8_t *p, uint16_t v) {
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+	put16(p, v);
+	put16(p + 2, v >> 16);
+}
+
+static void put64(uint8_t *p, uint64_t v) {
+	put32(p, v);
+	put32(p + 4, v >> 32);
+}
+
+static uint16_t get16(const uint8_t *p) {
+	return p[0] | p[1] << 8;
+}
+
+static uint32_t get32(const uint8_t *p) {
+	return get16(p) | (uint32_t)get16(p + 2) << 16;
+}
+
+static uint64_t get64(const uint8_t *p) {
+	return get32(p) | (uint64_t)get32(p + 4) << 32;
+}
+
+static uint8_t *put_varint(uint8_t *p, uint32_t v) {
+	while (v >= 0x80) {
+		*p++ = v | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+static uint32_t zigzag(int16_t v) {
+	return (uint16_t)((uint16_t)v << 1 ^ (v < 0 ? 0xFFFF : 0));
+}
+
+static int64_t get_varint(trace_reader_t *reader) {
+	int64_t v = 0;
+
+	for (int shift = 0; shift < 35; shift += 7) {
+		if (reader->pos >= reader->len) return -1;
+		uint8_t byte = reader->data[reader->pos++];
+		v |= (int64_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) return v;
+	}
+	return -1;
+}
+
+static int load_block(trace_reader_t *reader, size_t i) {
+	chip8_t *m = &reader->machine;
+	uint8_t *p = reader->data;
+
+	if (fseek(reader->fp, reader->offsets[i], SEEK_SET) ||
+		fread(p, 1, 12, reader->fp) != 12) return -1;
+	reader->len = get32(p + 4);
+	reader->left = get32(p + 8);
+	if (fread(p + 12, 1, reader->len - 12, reader->fp) != reader->len - 12) return -1;
+
+	p += 12;
+	reader->instr = get64(p);
+	reader->frame = get32(p + 8);
+	m->PC = get16(p + 12);
+	m->I = get16(p + 14);
+	p += 16;
+	memcpy(m->registers, p, 16);
+	p += 16;
+	m->stack.size = *p++ % 17;
+	for (int j = 0; j < 16; j++, p += 2) m->stack.array[j] = get16(p);
+	m->DT = *p++;
+	m->ST = *p++;
+	m->planes = *p++;
+	m->hires = *p++;
+	for (int plane = 0; plane < DISPLAY_PLANES; plane++) {
+		for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+			chip8_row_t row = {0};
+			for (int j = 0; j < 16; j++) row.w[j / 8] = row.w[j / 8] << 8 | *p++;
+			m->screen[plane][y] = row;
+		}
+	}
+
+	reader->block = i;
+	reader->pos = TRACE_KEYFRAME_SIZE;
+	return 0;
+}
+
+static void replay(trace_reader_t *reader, const trace_record_t *rec, const uint8_t *sprite) {
+	chip8_t *m = &reader->machine;
+	uint16_t op = rec->opcode;
+
+	switch (op >> 12) {
+	case 0x0:
+		if (op == 0x00EE) {
+			if (m->stack.size > 0) m->stack.size--;
+			return;
+		}
+		// the rest of 00xx draws, anything else is a call
+		if (op == 0x00E0 || (op & 0xFFE0) == 0x00C0 || (op >= 0x00FB && op <= 0x00FF)) break;
+		// fall through
+	case 0x2:
+		if (m->stack.size < 16) m->stack.array[m->stack.size++] = rec->PC + 2;
+		return;
+	case 0xD:
+		// the core reads the sprite back from memory
+		for (size_t i = 0; i < rec->sprite_len; i++) chip8_poke(m, m->I + i, sprite[i]);
+		break;
+	case 0xF:
+		if ((op & 0xFF) == 0x01) break;
+		return;
+	default:
+		return;
+	}
+
+	// run the drawing instruction on the rebuilt machine with the core
+	m->opcode = op;
+	m->running = 1;
+	m->halted = 0;
+	decode_and_exec(m);
+}
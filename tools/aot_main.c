@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/chip8.h"
+#include "../include/input.h"
+#include "../include/display.h"
+#include "../include/aot.h"
+#include "../include/clock.h"
+
+/* Front-end of a ROM compiled by ch8aot, make aot ROM=<rom-file> links
+	the two into chip8-aot. Runs the ROM in an SDL window, a frame of
+	--cycles instructions 60 times a second.
+
+	--verify runs headless instead, the compiled machine next to one on
+	chip8_run_frame() with the same random keys, and compares the state
+	hashes after every frame. Both runs are timed, the rates count the
+	cycles asked for like ch8sweep does.
+*/
+
+static chip8_state_t state;
+
+static void usage(void) {
+	printf("Use: chip8-aot [--cycles n] [--frames n] [--verify] [--seed n]\n");
+}
+
+static uint32_t hash(const chip8_t *chip8) {
+	// only the first save allocates, nothing can be compared without it
+	if (chip8_save_state(chip8, &state)) exit(1);
+	return chip8_state_hash(&state);
+}
+
+static int verify(size_t frames, size_t cycles, uint32_t seed) {
+	chip8_t compiled = {0}, interpreted = {0};
+	uint32_t rng = seed | 1;
+	uint16_t keys = 0;
+	uint64_t aot_ns = 0, interp_ns = 0;
+	int err = 0;
+
+	chip8_reset(&compiled);
+	chip8_reset(&interpreted);
+	if (aot_load(&compiled)) return 1;
+	chip8_attach(&interpreted, compiled.image);
+
+	for (size_t f = 0; f < frames && !err; f++) {
+		keys = bot_keys(&rng, keys);
+		compiled.keys = keys;
+		interpreted.keys = keys;
+
+		uint64_t start = now_ns();
+		chip8_run_frame(&interpreted, cycles);
+		interp_ns += now_ns() - start;
+
+		start = now_ns();
+		aot_run_frame(&compiled, cycles);
+		aot_ns += now_ns() - start;
+
+		// the opcode isn't hashed, the fetch has to match too
+		if (hash(&compiled) != hash(&interpreted) || compiled.opcode != interpreted.opcode ||
+			compiled.running != interpreted.running || compiled.halted != interpreted.halted) {
+			fprintf(stderr, "Error, the compiled machine differs from the interpreter after frame %zu\n", f);
+			err = 1;
+		}
+	}
+	printf("interpreted: %.1f M instructions/s\n", (double)frames * cycles * 1000.0 / (interp_ns ? interp_ns : 1));
+	printf("compiled: %.1f M instructions/s\n", (double)frames * cycles * 1000.0 / (aot_ns ? aot_ns : 1));
+	printf("final state: %08x%s\n", hash(&compiled), compiled.running ? "" : " stopped");
+	chip8_detach(&compiled);
+	chip8_detach(&interpreted);
+	return err;
+}
+
+int main(int argc, char **argv) {
+	size_t cycles = CYCLES_PER_FRAME, frames = 0;
+	uint32_t seed = 1;
+	int check = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc) cycles = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) frames = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) seed = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "--verify") == 0) check = 1;
+		else {
+			usage();
+			return 1;
+		}
+	}
+	if (cycles == 0) {
+		fprintf(stderr, "Error, a frame needs at least one cycle\n");
+		return 1;
+	}
+
+	int err = 0;
+	if (check) err = verify(frames ? frames : 600, cycles, seed);
+	else {
+		// create it on the stack
+		chip8_t chip8 = {0};
+		struct timespec next;
+
+		chip8_reset(&chip8);
+		if (displ_init(&chip8)) return 1;
+		if (aot_load(&chip8)) {
+			displ_destroy(&chip8);
+			return 1;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &next);
+		for (size_t f = 0; chip8.running && (frames == 0 || f < frames); f++) {
+			handle_input(&chip8);
+			aot_run_frame(&chip8, cycles);
+			if (chip8.draw) {
+				displ_present(&chip8);
+				chip8.draw = 0;
+			}
+			next.tv_nsec += 1000000000L / 60;
+			if (next.tv_nsec >= 1000000000L) {
+				next.tv_nsec -= 1000000000L;
+				next.tv_sec++;
+			}
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		}
+		chip8_detach(&chip8);
+		displ_destroy(&chip8);
+	}
+
+	uint64_t total = aot_stats.compiled + aot_stats.interpreted;
+	printf("aot: %" PRIu64 " instructions, %.1f%% compiled\n", total, total ? aot_stats.compiled * 100.0 / total : 0.0);
+	return err;
+}
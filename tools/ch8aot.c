@@ -0,0 +1,338 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/chip8.h"
+#include "../include/disasm.h"
+
+/* Compiles a ROM to C ahead of time, aot.h has what the output exports
+	and how it runs. make aot ROM=<rom-file> builds it into chip8-aot.
+
+	Code is found by following the ROM from 0x200, both ways out of a
+	skip, jump and call targets and the address after a call. A run is
+	the straight-line code from an instruction to the first one that
+	isn't followed by the next, every instruction gets a label and a
+	case in the dispatch switch, entering a run checks its bytes from
+	there to the end.
+*/
+
+#define PC_START 0x200
+// bytes per line of the embedded ROM
+#define ROM_PER_LINE 12
+
+// how an instruction leaves, everything but STRAIGHT ends a run
+enum kind {
+	STRAIGHT,	// on to the next instruction
+	SKIP,		// the next one or the one after
+	JUMP,		// 1NNN
+	CALL,		// 2NNN and 0NNN, the target, and the next one on return
+	WRITE,		// the next one, but the code may have changed under it
+	HALT,		// FX0A, the next one once a key is down
+	END			// 00EE, 00FD, BNNN and illegal opcodes, not known here
+};
+
+static chip8_t machine;
+static size_t rom_len;
+// instructions found, and addresses queued to be walked from
+static uint8_t code[SYS_MEMORY + 4];
+static uint8_t queued[SYS_MEMORY];
+static uint16_t work[SYS_MEMORY];
+static size_t work_len;
+// end of the run from each instruction, and 1 if the one before runs on into it
+static uint32_t run_end[SYS_MEMORY];
+static uint8_t inside[SYS_MEMORY + 4];
+
+static void usage(void) {
+	printf("Use: ch8aot <rom-file> <out.c>\n");
+}
+
+// how chip8_exec() leaves each opcode, the ones that stop the machine are END
+static int kind(uint16_t op) {
+	uint8_t X = (op & 0x0F00) >> 8;
+	uint8_t N = op & 0x000F;
+	uint8_t NN = op & 0x00FF;
+
+	switch (op >> 12) {
+	case 0x0:
+		if (op == 0x00EE || op == 0x00FD) return END;
+		if (op == 0x00E0 || (op & 0xFFE0) == 0x00C0 || (op >= 0x00FB && op <= 0x00FF)) return STRAIGHT;
+		return CALL;
+	case 0x1:
+		return JUMP;
+	case 0x2:
+		return CALL;
+	case 0x3:
+	case 0x4:
+	case 0x9:
+		return SKIP;
+	case 0x5:
+		if (N == 0x0) return SKIP;
+		if (N == 0x2) return WRITE;
+		return N == 0x3 ? STRAIGHT : END;
+	case 0x6:
+	case 0x7:
+	case 0x8:
+	case 0xA:
+	case 0xD:
+		return STRAIGHT;
+	case 0xE:
+		return NN == 0x9E || NN == 0xA1 ? SKIP : END;
+	case 0xF:
+		switch (NN) {
+		case 0x00:
+		case 0x02:
+			return X == 0 ? STRAIGHT : END;
+		case 0x01:
+		case 0x07:
+		case 0x15:
+		case 0x18:
+		case 0x1E:
+		case 0x29:
+		case 0x30:
+		case 0x3A:
+		case 0x65:
+			return STRAIGHT;
+		case 0x0A:
+			return HALT;
+		case 0x33:
+		case 0x55:
+			return WRITE;
+		}
+		return END;
+	}
+	// BNNN and the unimplemented CXNN
+	return END;
+}
+
+static uint32_t length(uint32_t addr) {
+	return chip8_peek16(&machine, addr) == 0xF000 ? 4 : 2;
+}
+
+// the whole instruction is in the ROM, code past it is written at run time
+static int in_rom(uint32_t addr) {
+	return addr >= PC_START && addr < PC_START + rom_len && addr + length(addr) <= PC_START + rom_len;
+}
+
+static void add(uint32_t addr) {
+	if (!in_rom(addr) || queued[addr]) return;
+	queued[addr] = 1;
+	work[work_len++] = addr;
+}
+
+static void walk(uint32_t addr) {
+	while (in_rom(addr) && !code[addr]) {
+		uint16_t op = chip8_peek16(&machine, addr);
+		uint32_t next = addr + length(addr);
+
+		code[addr] = 1;
+		switch (kind(op)) {
+		case STRAIGHT:
+			addr = next;
+			continue;
+		case SKIP:
+			// skip_instr() steps over F000 NNNN whole
+			add(next);
+			if (next < SYS_MEMORY) add(next + length(next));
+			break;
+		case JUMP:
+			add(op & 0x0FFF);
+			break;
+		case CALL:
+			add(op & 0x0FFF);
+			add(next);
+			break;
+		case WRITE:
+		case HALT:
+			add(next);
+			break;
+		}
+		return;
+	}
+}
+
+static void enter_at(FILE *fp, uint32_t addr) {
+	// the switch checks runs longer than a page
+	if (!code[addr] || run_end[addr] - addr > PAGE_SIZE) return;
+	fprintf(fp, "\tENTER(0x%04x, %u, i_%04x);\n", addr, run_end[addr] - addr, addr);
+}
+
+// where the instruction ending a run goes if it's known here
+static void enter(FILE *fp, uint16_t op, uint32_t next) {
+	switch (kind(op)) {
+	case SKIP:
+		enter_at(fp, next);
+		if (next < SYS_MEMORY) enter_at(fp, next + length(next));
+		break;
+	case JUMP:
+	case CALL:
+		enter_at(fp, op & 0x0FFF);
+		break;
+	case WRITE:
+	case HALT:
+		enter_at(fp, next);
+		break;
+	}
+}
+
+static void write_c(FILE *fp, const char *rom_path, size_t count) {
+	uint32_t rom_end = PC_START + rom_len;
+	char text[64];
+
+	fprintf(fp, "// Generated by ch8aot from %s, %zu instructions, don't edit\n\n", rom_path, count);
+	fprintf(fp, "#include <string.h>\n\n#include \"chip8.h\"\n#include \"exec.h\"\n#include \"aot.h\"\n\n");
+	fprintf(fp, "#define ROM_START 0x%03x\n\n", PC_START);
+	fprintf(fp, "// the state fetch() leaves, FX0A halted runs the opcode again, then the instruction\n");
+	fprintf(fp, "#define STEP(addr, op) \\\n\tchip8->PC = (addr) + 2; \\\n\tchip8->opcode = (op); \\\n");
+	fprintf(fp, "\tif (n == left) return n; \\\n\tchip8_exec(chip8, (op)); \\\n\tn++\n");
+	fprintf(fp, "// the run ended, load the next instruction\n");
+	fprintf(fp, "#define NEXT \\\n\tfetch(chip8); \\\n");
+	fprintf(fp, "\tif (n == left || !chip8->running || chip8->halted) return n\n");
+	fprintf(fp, "// a run of at most a page from addr is still the ROM, the pages were never written to or match\n");
+	fprintf(fp, "#define UNCHANGED(addr, len) \\\n");
+	fprintf(fp, "\t((!chip8->dirty[(addr) / PAGE_SIZE] && !chip8->dirty[((addr) + (len) - 1) / PAGE_SIZE]) || \\\n");
+	fprintf(fp, "\tunchanged(chip8, addr, len))\n");
+	fprintf(fp, "// straight on to a run the last one leads to, without the switch\n");
+	fprintf(fp, "#define ENTER(addr, len, label) \\\n");
+	fprintf(fp, "\tif (chip8->PC == (addr) + 2 && UNCHANGED(addr, len)) goto label\n\n");
+	fprintf(fp, "aot_stats_t aot_stats;\n\n");
+
+	fprintf(fp, "static const uint8_t rom[%zu] = {", rom_len);
+	for (size_t i = 0; i < rom_len; i++) {
+		fprintf(fp, "%s0x%02x,", i % ROM_PER_LINE ? " " : "\n\t", chip8_peek(&machine, PC_START + i));
+	}
+	fprintf(fp, "\n};\n\n");
+
+	fprintf(fp, "// the compiled code from addr on is still what's in memory, a clean page holds the ROM\n");
+	fprintf(fp, "static int unchanged(const chip8_t *chip8, uint16_t addr, uint16_t len) {\n");
+	fprintf(fp, "\tuint32_t a = addr, stop = (uint32_t)addr + len;\n\n");
+	fprintf(fp, "\twhile (a < stop) {\n");
+	fprintf(fp, "\t\tuint32_t n = PAGE_SIZE - a %% PAGE_SIZE;\n");
+	fprintf(fp, "\t\tif (n > stop - a) n = stop - a;\n");
+	fprintf(fp, "\t\tif (chip8->dirty[a / PAGE_SIZE] &&\n");
+	fprintf(fp, "\t\t\tmemcmp(&chip8->pages[a / PAGE_SIZE][a %% PAGE_SIZE], &rom[a - ROM_START], n)) return 0;\n");
+	fprintf(fp, "\t\ta += n;\n\t}\n\treturn 1;\n}\n\n");
+
+	fprintf(fp, "// at most left instructions from the PC, returns how many ran, 0 if there's no compiled code there\n");
+	fprintf(fp, "static size_t run(chip8_t *chip8, size_t left) {\n");
+	fprintf(fp, "\tsize_t n = 0;\n\n");
+	fprintf(fp, "dispatch:\n");
+	fprintf(fp, "\tif (n == left || !chip8->running || chip8->halted) return n;\n");
+	fprintf(fp, "\tswitch ((uint16_t)(chip8->PC - 2)) {\n");
+	for (uint32_t a = PC_START; a < rom_end; a++) {
+		if (!code[a]) continue;
+		fprintf(fp, "\tcase 0x%04x: if (%s0x%04x, %u)) goto i_%04x; return n;\n",
+			a, run_end[a] - a > PAGE_SIZE ? "unchanged(chip8, " : "UNCHANGED(", a, run_end[a] - a, a);
+	}
+	fprintf(fp, "\tdefault: return n;\n\t}\n");
+
+	for (uint32_t a = PC_START; a < rom_end; a++) {
+		if (!code[a]) continue;
+		uint16_t op = chip8_peek16(&machine, a);
+		uint32_t next = a + length(a);
+		uint32_t following = a + 1;
+
+		while (following < rom_end && !code[following]) following++;
+		if (!inside[a]) fprintf(fp, "\n");
+		disasm(op, chip8_peek16(&machine, a + 2), text, sizeof(text));
+		fprintf(fp, "i_%04x:\tSTEP(0x%04x, 0x%04x);\t// %s\n", a, a, op, text);
+
+		if (kind(op) != STRAIGHT || !code[next]) {
+			fprintf(fp, "\tNEXT;\n");
+			enter(fp, op, next);
+			fprintf(fp, "\tgoto dispatch;\n");
+		}
+		// F000 NNNN with a jump into its second word
+		else if (next != following) fprintf(fp, "\tgoto i_%04x;\n", next);
+	}
+	fprintf(fp, "}\n\n");
+
+	fprintf(fp, "int aot_load(chip8_t *chip8) {\n");
+	fprintf(fp, "\treturn chip8_load_image(chip8, rom, sizeof(rom));\n}\n\n");
+
+	fprintf(fp, "void aot_run_frame(chip8_t *chip8, size_t cycles) {\n");
+	fprintf(fp, "\t// the hooks only see decode_and_exec()\n");
+	fprintf(fp, "\tint hooked = chip8->debugger || chip8->trace || chip8->profile;\n");
+	fprintf(fp, "\tsize_t i = 0;\n\n");
+	fprintf(fp, "\twhile (i < cycles && chip8->running) {\n");
+	fprintf(fp, "\t\tsize_t n = 0;\n\n");
+	fprintf(fp, "\t\tif (!hooked && !chip8->paused && !chip8->trapped) n = run(chip8, cycles - i);\n");
+	fprintf(fp, "\t\taot_stats.compiled += n;\n");
+	fprintf(fp, "\t\tif (n == 0) {\n");
+	fprintf(fp, "\t\t\tdecode_and_exec(chip8);\n\t\t\tfetch(chip8);\n");
+	fprintf(fp, "\t\t\taot_stats.interpreted++;\n\t\t\tn = 1;\n\t\t}\n");
+	fprintf(fp, "\t\ti += n;\n\t}\n");
+	fprintf(fp, "\tchip8_tick_timers(chip8);\n}\n");
+}
+
+int main(int argc, char **argv) {
+	if (argc != 3) {
+		usage();
+		return 1;
+	}
+
+	// the ROM goes through the core's loader, the scan reads it with chip8_peek16()
+	FILE *fp = fopen(argv[1], "rb");
+	if (fp == NULL) {
+		fprintf(stderr, "Error, opening ch8 image: %s\n", argv[1]);
+		return 1;
+	}
+	fseek(fp, 0, SEEK_END);
+	long len = ftell(fp);
+	rewind(fp);
+	if (len <= 0 || SYS_MEMORY - PC_START < len) {
+		fprintf(stderr, "Error, the image is empty or too large!\n");
+		fclose(fp);
+		return 1;
+	}
+	uint8_t *rom = malloc(len);
+	if (rom == NULL || fread(rom, 1, len, fp) != (size_t)len) {
+		fprintf(stderr, "Error, reading ch8 image: %s\n", argv[1]);
+		free(rom);
+		fclose(fp);
+		return 1;
+	}
+	fclose(fp);
+	rom_len = len;
+	chip8_reset(&machine);
+	int err = chip8_load_image(&machine, rom, rom_len);
+	free(rom);
+	if (err) return 1;
+
+	add(PC_START);
+	while (work_len > 0) walk(work[--work_len]);
+
+	// runs only go forward, the end of the next instruction's run is known first
+	size_t count = 0, runs = 0;
+	for (uint32_t a = PC_START + rom_len; a-- > PC_START; ) {
+		if (!code[a]) continue;
+		uint32_t next = a + length(a);
+		run_end[a] = next;
+		if (kind(chip8_peek16(&machine, a)) == STRAIGHT && code[next]) {
+			run_end[a] = run_end[next];
+			inside[next] = 1;
+		}
+		count++;
+	}
+	for (uint32_t a = PC_START; a < PC_START + rom_len; a++) {
+		if (code[a] && !inside[a]) runs++;
+	}
+
+	fp = fopen(argv[2], "w");
+	if (fp == NULL) {
+		fprintf(stderr, "Error, opening output: %s\n", argv[2]);
+		chip8_detach(&machine);
+		return 1;
+	}
+	write_c(fp, argv[1], count);
+	err = ferror(fp);
+	if (fclose(fp) || err) {
+		fprintf(stderr, "Error, writing output: %s\n", argv[2]);
+		chip8_detach(&machine);
+		return 1;
+	}
+
+	printf("ch8aot: %zu instructions in %zu runs out of %zu ROM bytes, written to %s\n",
+		count, runs, rom_len, argv[2]);
+	chip8_detach(&machine);
+	return 0;
+}
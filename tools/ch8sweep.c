@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/chip8.h"
+#include "../include/input.h"
+#include "../include/batch.h"
+#include "../include/clock.h"
+
+/* Runs one ROM on BATCH_LANES machines at once, each with its own
+	random input, and prints every machine's final state hash.
+
+	--verify runs the same inputs through chip8_run_frame() one machine
+	at a time as well and compares the hashes after every frame, both
+	runs are timed. The rates count the cycles asked for, a machine that
+	stopped on an error counts as if it ran.
+*/
+
+static batch_t batch;
+static chip8_t scalar[BATCH_LANES];
+static chip8_state_t state;
+
+static void usage(void) {
+	printf("Use: ch8sweep <rom-file> [--lanes n] [--frames n] [--cycles n] [--seed n] [--verify]\n");
+}
+
+static uint32_t hash(const chip8_t *chip8) {
+	// only the first save allocates, nothing can be compared without it
+	if (chip8_save_state(chip8, &state)) exit(1);
+	return chip8_state_hash(&state);
+}
+
+int main(int argc, char **argv) {
+	size_t lanes = BATCH_LANES, frames = 600, cycles = 500;
+	uint32_t seed = 1;
+	int verify = 0;
+
+	if (argc < 2) {
+		usage();
+		return 1;
+	}
+	for (int i = 2; i < argc; i++) {
+		if (strcmp(argv[i], "--lanes") == 0 && i + 1 < argc) lanes = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) frames = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc) cycles = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) seed = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "--verify") == 0) verify = 1;
+		else {
+			usage();
+			return 1;
+		}
+	}
+	if (cycles == 0 || cycles > UINT16_MAX) {
+		fprintf(stderr, "Error, cycles per frame go from 1 to %d\n", UINT16_MAX);
+		return 1;
+	}
+
+	// every machine shares the ROM image
+	chip8_t loader = {0};
+	chip8_reset(&loader);
+	if (chip8_load_rom(&loader, argv[1])) return 1;
+	if (batch_init(&batch, loader.image, lanes)) {
+		chip8_detach(&loader);
+		return 1;
+	}
+
+	uint32_t rng[BATCH_LANES] = {0};
+	uint16_t keys[BATCH_LANES] = {0};
+	uint64_t batch_ns = 0;
+	for (size_t lane = 0; lane < lanes; lane++) rng[lane] = (seed + lane * 0x9E3779B9u) | 1;
+
+	if (verify) {
+		uint32_t scalar_rng[BATCH_LANES];
+		uint16_t scalar_keys[BATCH_LANES] = {0};
+		uint64_t scalar_ns = 0;
+
+		memcpy(scalar_rng, rng, sizeof(rng));
+		for (size_t lane = 0; lane < lanes; lane++) chip8_attach(&scalar[lane], loader.image);
+
+		for (size_t f = 0; f < frames; f++) {
+			uint64_t start = now_ns();
+			for (size_t lane = 0; lane < lanes; lane++) {
+				scalar_keys[lane] = bot_keys(&scalar_rng[lane], scalar_keys[lane]);
+				scalar[lane].keys = scalar_keys[lane];
+				chip8_run_frame(&scalar[lane], cycles);
+			}
+			scalar_ns += now_ns() - start;
+
+			start = now_ns();
+			for (size_t lane = 0; lane < lanes; lane++) {
+				keys[lane] = bot_keys(&rng[lane], keys[lane]);
+				batch.keys[lane] = keys[lane];
+			}
+			batch_run_frame(&batch, cycles);
+			batch_ns += now_ns() - start;
+
+			for (size_t lane = 0; lane < lanes; lane++) {
+				if (hash(batch_lane(&batch, lane)) == hash(&scalar[lane])) continue;
+				fprintf(stderr, "Error, lane %zu differs from the scalar machine after frame %zu\n", lane, f);
+				verify = -1;
+			}
+			if (verify < 0) break;
+		}
+		for (size_t lane = 0; lane < lanes; lane++) chip8_detach(&scalar[lane]);
+		printf("scalar: %.1f M instructions/s\n", (double)lanes * frames * cycles * 1000.0 / scalar_ns);
+	}
+	else {
+		uint64_t start = now_ns();
+		for (size_t f = 0; f < frames; f++) {
+			for (size_t lane = 0; lane < lanes; lane++) {
+				keys[lane] = bot_keys(&rng[lane], keys[lane]);
+				batch.keys[lane] = keys[lane];
+			}
+			batch_run_frame(&batch, cycles);
+		}
+		batch_ns = now_ns() - start;
+	}
+
+	uint64_t total = batch.vector_instr + batch.scalar_instr;
+	printf("batch: %.1f M instructions/s, %.2f lanes per step, %.1f%% through the core\n",
+		(double)lanes * frames * cycles * 1000.0 / batch_ns, (double)total / (batch.steps ? batch.steps : 1),
+		total ? batch.scalar_instr * 100.0 / total : 0.0);
+	for (size_t lane = 0; lane < lanes; lane++) {
+		chip8_t *chip8 = batch_lane(&batch, lane);
+		printf("lane %2zu: %08x%s\n", lane, hash(chip8), chip8->running ? "" : " stopped");
+	}
+
+	batch_free(&batch);
+	chip8_detach(&loader);
+	return verify < 0;
+}
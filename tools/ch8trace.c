@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/chip8.h"
+#include "../include/trace.h"
+
+/* Reads a trace written with --trace.
+
+	Lists the instructions, or the ones matching the filters, from the
+	start or from the end of a frame. --state prints the machine and the
+	screen at the end of a frame instead, --stats counts the whole trace.
+*/
+
+static void usage(void) {
+	printf("Use: ch8trace <trace-file> [--frame n] [--count n] [--pc lo[-hi]]\n");
+	printf("         [--op pattern, x matches any digit, e.g. dxxx] [--reg n]\n");
+	printf("     ch8trace <trace-file> --frame n --state\n");
+	printf("     ch8trace <trace-file> --stats\n");
+}
+
+static int match_op(const char *pattern, uint16_t opcode) {
+	for (int i = 0; i < 4; i++) {
+		char c = pattern[i];
+		int digit = opcode >> (12 - i * 4) & 0xF;
+		if (c == 'x' || c == 'X') continue;
+		if (strtol((char[]){c, '\0'}, NULL, 16) != digit) return 0;
+	}
+	return 1;
+}
+
+static void print_record(const trace_reader_t *reader, const trace_record_t *rec) {
+	if (rec->flags & TRACE_FRAME) {
+		printf("%12" PRIu64 "  frame %u  DT=%02x ST=%02x\n", rec->instr, rec->frame,
+			reader->machine.DT, reader->machine.ST);
+		return;
+	}
+	printf("%12" PRIu64 "  %04x  %04x  I=%04x", rec->instr, rec->PC, rec->opcode, reader->machine.I);
+	for (int i = 0; i < 16; i++) {
+		if (rec->regs & 1 << i) printf(" V%X=%02x", i, reader->machine.registers[i]);
+	}
+	if (rec->sprite_len) printf(" sprite %u bytes", rec->sprite_len);
+	if (rec->flags & TRACE_TIMERS) printf(" DT=%02x ST=%02x", reader->machine.DT, reader->machine.ST);
+	printf("\n");
+}
+
+static void print_state(const trace_reader_t *reader) {
+	const chip8_t *m = &reader->machine;
+	static const char shades[] = " #+.";
+
+	printf("frame %u, %" PRIu64 " instructions\n", reader->frame, reader->instr);
+	// the machine's PC is one past the last instruction, even if it jumped
+	if (reader->instr > 0) printf("last instruction at %04x, ", m->PC - 2);
+	printf("I=%04x DT=%02x ST=%02x planes=%d %s\n", m->I, m->DT, m->ST,
+		m->planes, m->hires ? "hires" : "lores");
+	for (int i = 0; i < 16; i++) printf("V%X=%02x%c", i, m->registers[i], i % 8 == 7 ? '\n' : ' ');
+	printf("stack:");
+	for (size_t i = 0; i < m->stack.size; i++) printf(" %04x", m->stack.array[i]);
+	printf("\n");
+
+	for (int y = 0; y < chip8_height(m); y++) {
+		for (int x = 0; x < chip8_width(m); x++) putchar(shades[chip8_pixel(m, x, y)]);
+		putchar('\n');
+	}
+}
+
+int main(int argc, char **argv) {
+	trace_reader_t reader;
+	trace_record_t rec;
+	long frame = -1, count = -1, reg = -1;
+	long pc_lo = -1, pc_hi = -1;
+	const char *op = NULL;
+	int state = 0, stats = 0;
+	int ret = 0;
+
+	if (argc < 2) {
+		usage();
+		return 1;
+	}
+	for (int i = 2; i < argc; i++) {
+		char *end;
+		if (strcmp(argv[i], "--frame") == 0 && i + 1 < argc) frame = atol(argv[++i]);
+		else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc) count = atol(argv[++i]);
+		else if (strcmp(argv[i], "--reg") == 0 && i + 1 < argc) reg = strtol(argv[++i], NULL, 16) & 0xF;
+		else if (strcmp(argv[i], "--op") == 0 && i + 1 < argc && strlen(argv[i + 1]) == 4) op = argv[++i];
+		else if (strcmp(argv[i], "--pc") == 0 && i + 1 < argc) {
+			pc_lo = strtol(argv[++i], &end, 16);
+			pc_hi = *end == '-' ? strtol(end + 1, NULL, 16) : pc_lo;
+		}
+		else if (strcmp(argv[i], "--state") == 0) state = 1;
+		else if (strcmp(argv[i], "--stats") == 0) stats = 1;
+		else {
+			usage();
+			return 1;
+		}
+	}
+
+	if (trace_reader_open(&reader, argv[1])) return 1;
+
+	if (frame >= 0 && trace_reader_seek(&reader, frame)) {
+		fprintf(stderr, "Error, the trace ends before frame %ld\n", frame);
+		trace_reader_close(&reader);
+		return 1;
+	}
+	if (state) {
+		print_state(&reader);
+		trace_reader_close(&reader);
+		return 0;
+	}
+
+	if (stats) {
+		uint64_t ops[16] = {0}, sprites = 0, jumps = 0;
+		while ((ret = trace_reader_next(&reader, &rec)) > 0) {
+			if (rec.flags & TRACE_FRAME) continue;
+			ops[rec.opcode >> 12]++;
+			if (rec.sprite_len) sprites++;
+			if (rec.flags & TRACE_PC) jumps++;
+		}
+		printf("%" PRIu64 " instructions, %u frames, %zu blocks, %" PRIu64 " taken branches, %" PRIu64 " sprites\n",
+			reader.instr, reader.frame, reader.blocks, jumps, sprites);
+		for (int i = 0; i < 16; i++) {
+			printf("  %Xxxx %12" PRIu64 " %5.1f%%\n", i, ops[i], reader.instr ? ops[i] * 100.0 / reader.instr : 0.0);
+		}
+	}
+	else {
+		while (count != 0 && (ret = trace_reader_next(&reader, &rec)) > 0) {
+			int filtered = pc_lo >= 0 || op != NULL || reg >= 0;
+			if (rec.flags & TRACE_FRAME) {
+				if (filtered) continue;
+			}
+			else {
+				if (pc_lo >= 0 && (rec.PC < pc_lo || rec.PC > pc_hi)) continue;
+				if (op != NULL && !match_op(op, rec.opcode)) continue;
+				if (reg >= 0 && !(rec.regs & 1 << reg)) continue;
+			}
+			print_record(&reader, &rec);
+			if (count > 0) count--;
+		}
+		if (count == 0) ret = 0;
+	}
+
+	if (ret < 0) fprintf(stderr, "Error, the trace is corrupt after instruction %" PRIu64 "\n", reader.instr);
+	trace_reader_close(&reader);
+	return ret < 0;
+}